@@ -64,6 +64,9 @@ extern "C" {
 #define NUMBER_LIMIT_NODE      ((1L << BIT_LIMIT_NODE) - 1)
 #define NUMBER_LIMIT_TIMESTAMP ((1L << BIT_LIMIT_TIMESTAMP) - 1)
 
+/* environment variable with cached node id, see yauid_export_node_id */
+#define YAUID_NODE_ID_ENV "YAUID_NODE_ID"
+
 // 64 bit
 typedef uint64_t hkey_t;
 
@@ -84,10 +87,151 @@ enum yauid_status {
     YAUID_ERROR_FLUSH_KEY,
     YAUID_ERROR_TRY_COUNT_KEY,
     YAUID_ERROR_CREATE_OBJECT,
-    YAUID_ERROR_ALLOC_KEY_FILE
+    YAUID_ERROR_ALLOC_KEY_FILE,
+    YAUID_ERROR_STATE_FORMAT,
+    YAUID_ERROR_STATE_VERSION,
+    YAUID_ERROR_STATE_LAYOUT,
+    YAUID_ERROR_STATE_ENDIAN,
+    YAUID_ERROR_STATE_CHECKSUM,
+    YAUID_ERROR_PREFETCH_THREAD,
+    YAUID_ERROR_MERGE_STARTED,
+    YAUID_ERROR_SYNC_KEY,
+    YAUID_ERROR_STATE_CHANGED,
+    YAUID_ERROR_INDEX_OPEN,
+    YAUID_ERROR_INDEX_FORMAT,
+    YAUID_ERROR_INDEX_WRITE,
+    YAUID_ERROR_BACKFILL_RANGE,
+    YAUID_ERROR_BACKFILL_NODE_ID,
+    YAUID_ERROR_BACKFILL_HISTORY
 }
 typedef yauid_status_t;
 
+/***********************************************************************************
+ *
+ * State file (lock.yauid), format v2
+ *
+ * Fixed-size file of YAUID_STATE_SLOT_SIZE-byte slots. Every slot starts on its own
+ * cache line and ends with a checksum of the preceding bytes, so the file can be
+ * read as-is (or mmap-ed) without any parsing. Values are stored in host byte order;
+ * the endian field detects a file moved between hosts of different byte order.
+ *
+ * A legacy lock file (a single 8 byte key) is upgraded on the first write.
+ * The counter slot comes first, so the last key stays at offset 0 where a legacy
+ * (v1) binary reads and writes it: both versions may share one lock file during
+ * a rollout. A key written by v1 is detected by key != key_copy and taken over.
+ *
+ ***********************************************************************************/
+
+#define YAUID_STATE_SLOT_SIZE 64
+#define YAUID_STATE_MAGIC     0x3254534449554159ULL /* "YAUIDST2" */
+#define YAUID_STATE_VERSION   2
+#define YAUID_STATE_ENDIAN    0x0102030405060708ULL
+
+/* stats.flags: keys were issued before stats.first (lock file upgraded from 8 byte format) */
+#define YAUID_STATE_STATS_PARTIAL 0x1
+
+struct yauid_state_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t size;           /* sizeof(yauid_state) */
+    uint64_t endian;         /* YAUID_STATE_ENDIAN */
+    uint8_t  bit_limit;      /* bit layout of keys: BIT_LIMIT_* */
+    uint8_t  bit_timestamp;
+    uint8_t  bit_node;
+    uint8_t  bit_inc;
+    uint32_t min_node_id;    /* LIMIT_MIN_NODE_ID */
+    uint8_t  reserved[24];
+    uint64_t checksum;
+}
+typedef yauid_state_header;
+
+struct yauid_state_counter {
+    hkey_t   key;            /* last issued key; offset 0 of the file */
+    hkey_t   key_copy;       /* key as written by v2; checksum covers key_copy, not key */
+    uint8_t  reserved[40];
+    uint64_t checksum;
+}
+typedef yauid_state_counter;
+
+struct yauid_state_reserve {
+    hkey_t   key;            /* last key of an issued reservation */
+    uint64_t count;          /* number of keys in the reservation */
+    uint8_t  reserved[40];
+    uint64_t checksum;
+}
+typedef yauid_state_reserve;
+
+struct yauid_state_stats {
+    uint64_t keys;           /* total keys issued from this file */
+    uint64_t seconds;        /* number of seconds in which keys were issued */
+    uint64_t first;          /* timestamp of the first key issued in format v2 */
+    uint64_t last;           /* timestamp of the last issued key */
+    uint32_t flags;          /* YAUID_STATE_STATS_* */
+    uint8_t  reserved[20];
+    uint64_t checksum;
+}
+typedef yauid_state_stats;
+
+struct yauid_state {
+    yauid_state_counter counter;
+    yauid_state_header  header;
+    yauid_state_reserve reserve;
+    yauid_state_stats   stats;
+}
+typedef yauid_state;
+
+/***********************************************************************************
+ *
+ * Prefetch: background thread keeps a lock-free ring of keys filled
+ *
+ ***********************************************************************************/
+
+struct yauid_prefetch_stat {
+    uint64_t hits;           /* keys taken from the ring */
+    uint64_t misses;         /* ring was empty, key taken from lock file */
+    uint64_t stale;          /* keys dropped as older than max age */
+}
+typedef yauid_prefetch_stat;
+
+struct yauid_prefetch;
+struct yauid_durable;
+
+/***********************************************************************************
+ *
+ * State backends
+ *
+ * reserve: lock and read state (see yauid_state); counter.key is the last issued key
+ * commit:  store new state and unlock; reserved_key is counter.key returned by reserve.
+ *          Optimistic backends return YAUID_ERROR_STATE_CHANGED if the last key is
+ *          not reserved_key any more, and the key is computed again
+ * release: unlock without store
+ *
+ ***********************************************************************************/
+
+struct yauid;
+
+struct yauid_backend {
+    const char *name;
+    
+    yauid_status_t (*open)(struct yauid *yaobj, const char *filepath_key);
+    void           (*close)(struct yauid *yaobj);
+    yauid_status_t (*reserve)(struct yauid *yaobj, yauid_state *state);
+    yauid_status_t (*commit)(struct yauid *yaobj, yauid_state *state, hkey_t reserved_key);
+    void           (*release)(struct yauid *yaobj);
+}
+typedef yauid_backend;
+
+/* lock file with flock; default */
+extern const yauid_backend yauid_backend_file;
+/* lock file with flock, opened on the first key; see yauid_init_lazy */
+extern const yauid_backend yauid_backend_file_lazy;
+/*
+ * process-wide atomic, no file access; keys are unique within one process only.
+ * Nothing is stored across restarts, so the first key waits for the next second
+ * (up to 1 second) to avoid keys of a previous process with the same node id
+ */
+extern const yauid_backend yauid_backend_memory;
+
 // base structure
 struct yauid {
     int           i_lockfile;
@@ -100,6 +244,13 @@ struct yauid {
     
     enum yauid_status error;
     void *ext_value;
+    
+    yauid_state_header state_header;
+    struct yauid_prefetch *prefetch;
+    struct yauid_durable  *durable;
+    
+    const yauid_backend *backend;
+    void *backend_data;
 }
 typedef yauid;
 
@@ -124,6 +275,40 @@ typedef yauid_period_key;
  */
 yauid * yauid_init(const char *filepath_key, const char *filepath_node_id);
 
+/**
+ * Create a new yauid with state backend
+ *
+ * @param[in] backend, e.g. &yauid_backend_file or &yauid_backend_memory
+ * @param[in] backend path: lock file for yauid_backend_file, NULL for yauid_backend_memory
+ * @param[in] NULL or file path to node id. See yauid_set_node_id
+ * @return yauid structure
+ */
+yauid * yauid_init_backend(const yauid_backend *backend, const char *filepath_key, const char *filepath_node_id);
+
+/**
+ * Create a new yauid for short-lived processes: no file access until the first key,
+ * lock file is opened with one open(2) on the first key (yauid_backend_file_lazy).
+ * Node id read from file is cached for next calls in the process. It is also taken
+ * from environment variable YAUID_NODE_ID_ENV if that was exported for the same file
+ * (see yauid_export_node_id). yauid_set_durable works after the first key only
+ *
+ * @param[in] File path to lock file. Important! All yauid (on one node) link to this file
+ * @param[in] NULL or file path to node id. See yauid_set_node_id
+ * @return yauid structure
+ */
+yauid * yauid_init_lazy(const char *filepath_key, const char *filepath_node_id);
+
+/**
+ * Export node id of yauid to environment variable YAUID_NODE_ID_ENV as
+ * "<node id>:<file path>" for yauid_init_lazy of child processes.
+ * Calls setenv(3): not thread-safe, call it before threads are started
+ *
+ * @param[in] yauid
+ * @param[in] file path to node id the node id was read from
+ * @return YAUID_OK if successful or error code
+ */
+yauid_status_t yauid_export_node_id(yauid* yaobj, const char *filepath_node_id);
+
 /**
  * Frees all allocated resources
  *
@@ -147,6 +332,71 @@ hkey_t yauid_get_key(yauid* yaobj);
  */
 hkey_t yauid_get_key_once(yauid* yaobj);
 
+/**
+ * Tries once get up to count unique keys by current node with one lock of key file.
+ * All keys belong to the current second, so less than count keys may be returned
+ *
+ * @param[in] yauid
+ * @param[out] array for keys
+ * @param[in] max number of keys
+ * @return number of keys; 0 if any error. See yauid_get_error_code
+ */
+size_t yauid_get_keys_once(yauid* yaobj, hkey_t *keys, size_t count);
+
+/**
+ * Durable mode: keys are returned only after the lock file is synced to disk (fdatasync),
+ * so a power loss can't roll the lock file back to an already issued key. Threads sharing
+ * the handle are grouped: the first waiter sleeps interval_usec, then one fdatasync
+ * covers all keys written so far. In durable mode the handle may be used by several threads:
+ * status of a key (including YAUID_ERROR_SYNC_KEY) is kept per call, yauid_get_error_code
+ * returns the status of the last call of any thread.
+ * Start prefetch after durable mode to make keys of the ring durable too
+ *
+ * @param[in] yauid
+ * @param[in] 1 = on, 0 = off
+ * @param[in] commit interval in microseconds; 0 = sync at once
+ * @return YAUID_OK if successful or error code
+ */
+yauid_status_t yauid_set_durable(yauid* yaobj, int durable, useconds_t interval_usec);
+
+/**
+ * Start background thread that keeps a ring of keys; yauid_get_key and yauid_get_key_once
+ * take keys from the ring first and may be called from several threads; retries are decided
+ * per call, yauid_get_error_code returns the status of the last call of any thread. The thread uses
+ * its own descriptor of the lock file, so set node id before start. Keys left in the ring are dropped by yauid_prefetch_stop
+ *
+ * @param[in] yauid
+ * @param[in] ring size; rounded up to power of 2
+ * @param[in] low watermark: ring is refilled when it holds fewer keys
+ * @param[in] max age of a key in seconds; older keys are dropped. 0 = keep all keys
+ * @return YAUID_OK if successful or error code
+ */
+yauid_status_t yauid_prefetch_start(yauid* yaobj, size_t size, size_t low_watermark, unsigned int max_age);
+
+/**
+ * Stop background thread and drop keys of ring
+ *
+ * @param[in] yauid
+ */
+void yauid_prefetch_stop(yauid* yaobj);
+
+/**
+ * Get ring hit and miss counters
+ *
+ * @param[in] yauid
+ * @param[out] counters; zero if prefetch is not started
+ */
+void yauid_get_prefetch_stat(yauid* yaobj, yauid_prefetch_stat *stat);
+
+/**
+ * Read state of lock file. Legacy (v1) and empty files are returned converted to v2
+ *
+ * @param[in] yauid
+ * @param[out] state
+ * @return YAUID_OK if successful or error code
+ */
+yauid_status_t yauid_get_state(yauid* yaobj, yauid_state *state);
+
 /**
  * Set current node id
  *
@@ -0,0 +1,159 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef yauid_yauid_backfill_h
+#define yauid_yauid_backfill_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <yauid.h>
+
+/***********************************************************************************
+ *
+ * Backfill: keys for historical rows
+ *
+ * Issues keys of a node for arbitrary seconds of a timestamp range, keeping the
+ * inc counter of every second in a table of 4 bytes per second (8 with remap).
+ * Seconds the live node may have used (from the first key of its lock file on)
+ * are refused or moved to a reserved backfill node id. Counters saturate at
+ * yauid_get_max_inc(); keys over it are 0.
+ * Key functions are thread-safe: counters are taken with atomic adds.
+ *
+ * All seconds are refused until yauid_backfill_set_live or yauid_backfill_set_live_from
+ * is called. Counters are kept in memory only: one object must own a (node id, range)
+ * pair for good. A restarted or second job for the same pair must first load the keys
+ * already issued (e.g. from the target table or a yauid_index) with yauid_backfill_seed,
+ * otherwise it issues the same keys again.
+ *
+ ***********************************************************************************/
+
+enum yauid_backfill_policy {
+    YAUID_BACKFILL_REFUSE = 0,   /* key 0 for seconds of live node */
+    YAUID_BACKFILL_REMAP         /* keys of backfill node id for seconds of live node */
+}
+typedef yauid_backfill_policy;
+
+struct yauid_backfill {
+    unsigned long node_id;
+    unsigned long backfill_node_id;
+    yauid_backfill_policy policy;
+    
+    uint64_t from;           /* timestamp range */
+    uint64_t to;
+    uint64_t live_from;      /* first second of live node; 0 = none; from until set */
+    
+    uint32_t *counters;      /* last inc per second of node_id */
+    uint32_t *remap_counters;/* last inc per second of backfill_node_id */
+    
+    uint64_t issued;
+    uint64_t remapped;
+    uint64_t refused;        /* seconds of live node with YAUID_BACKFILL_REFUSE or out of range */
+    uint64_t exhausted;      /* over yauid_get_max_inc() keys in a second */
+    
+    yauid_status_t error;
+}
+typedef yauid_backfill;
+
+/**
+ * Create a new backfill generator
+ *
+ * @param[in] node id
+ * @param[in] from timestamp
+ * @param[in] to timestamp
+ * @return yauid_backfill structure (see yauid_backfill.error) or NULL if memory can't be allocated
+ */
+yauid_backfill * yauid_backfill_create(unsigned long node_id, time_t from, time_t to);
+
+/**
+ * Frees all allocated resources
+ *
+ * @param[in] yauid_backfill
+ */
+void yauid_backfill_destroy(yauid_backfill* backfill);
+
+/**
+ * Continue after keys issued before (by a previous job): counters of their seconds
+ * are raised to their inc. Keys of other node ids or seconds are skipped. For keys of
+ * the backfill node id call it after yauid_backfill_set_live* with YAUID_BACKFILL_REMAP
+ *
+ * @param[in] yauid_backfill
+ * @param[in] issued keys, in any order
+ * @param[in] number of keys
+ * @return number of keys taken into account
+ */
+size_t yauid_backfill_seed(yauid_backfill* backfill, const hkey_t *keys, size_t count);
+
+/**
+ * Protect seconds of live node: from the first key recorded in the lock file of the
+ * handle on (see yauid_state_stats). Node id is taken from the last key of the lock file,
+ * not from the handle; a lock file of another node protects nothing.
+ * A lock file upgraded from the 8 byte format keeps only its last legacy key, so earlier
+ * live seconds are unknown: YAUID_ERROR_BACKFILL_HISTORY is returned, use
+ * yauid_backfill_set_live_from with the first second of the node instead
+ *
+ * @param[in] yauid_backfill
+ * @param[in] live yauid with the lock file of the node; node id of the handle is not used
+ * @param[in] policy for seconds of live node
+ * @param[in] node id for YAUID_BACKFILL_REMAP; not equal to node id of backfill
+ * @return YAUID_OK if successful or error code
+ */
+yauid_status_t yauid_backfill_set_live(yauid_backfill* backfill, yauid* yaobj,
+                                       yauid_backfill_policy policy, unsigned long backfill_node_id);
+
+/**
+ * Protect seconds from live_from on (see yauid_backfill_set_live)
+ *
+ * @param[in] yauid_backfill
+ * @param[in] first second of live node; 0 = none
+ * @param[in] policy for seconds of live node
+ * @param[in] node id for YAUID_BACKFILL_REMAP
+ * @return YAUID_OK if successful or error code
+ */
+yauid_status_t yauid_backfill_set_live_from(yauid_backfill* backfill, time_t live_from,
+                                            yauid_backfill_policy policy, unsigned long backfill_node_id);
+
+/**
+ * Get keys for rows. Thread-safe
+ *
+ * @param[in] yauid_backfill
+ * @param[in] timestamps of rows; runs of equal timestamps take one atomic add
+ * @param[in] number of rows
+ * @param[out] array of count keys; 0 if refused, out of range or exhausted
+ * @return number of issued keys
+ */
+size_t yauid_backfill_get_keys(yauid_backfill* backfill, const time_t *timestamps, size_t count, hkey_t *keys);
+
+/**
+ * Get keys for rows with several threads (see yauid_backfill_get_keys)
+ *
+ * @param[in] yauid_backfill
+ * @param[in] timestamps of rows
+ * @param[in] number of rows
+ * @param[out] array of count keys
+ * @param[in] number of threads; 0 or 1 = caller thread
+ * @return number of issued keys
+ */
+size_t yauid_backfill_run(yauid_backfill* backfill, const time_t *timestamps, size_t count,
+                          hkey_t *keys, unsigned int threads);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
+
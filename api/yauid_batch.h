@@ -0,0 +1,131 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef yauid_yauid_batch_h
+#define yauid_yauid_batch_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <yauid.h>
+
+/***********************************************************************************
+ *
+ * Batch operations on keys
+ *
+ ***********************************************************************************/
+
+/* size in bytes of allowed nodes bitmap: bit (node_id & 7) of byte (node_id >> 3) */
+#define YAUID_VALIDATE_NODES_SIZE ((NUMBER_LIMIT_NODE >> 3) + 1)
+
+struct yauid_validate {
+    unsigned long from_timestamp;
+    unsigned long to_timestamp;
+    unsigned long from_node_id;
+    unsigned long to_node_id;
+    const uint8_t *nodes;    /* NULL or bitmap of allowed node ids */
+}
+typedef yauid_validate;
+
+/**
+ * Split keys into timestamp, node id and inc id (see yauid_get_timestamp, yauid_get_node_id,
+ * yauid_get_inc_id). Loops are branch-free; on x86-64 they use SSE2, 2 keys at a time
+ *
+ * @param[in] keys
+ * @param[in] number of keys
+ * @param[out] NULL or array of count timestamps
+ * @param[out] NULL or array of count node ids
+ * @param[out] NULL or array of count inc ids
+ */
+void yauid_decode_keys(const hkey_t *keys, size_t count,
+                       unsigned long *timestamps, unsigned long *node_ids, unsigned long *incs);
+
+/**
+ * Get minimum and maximum key for every window of a time grid.
+ * Window i covers timestamps from start + i * step to start + (i + 1) * step - 1.
+ * Windows are returned sorted and non-overlapping, ready for yauid_classify_keys
+ *
+ * @param[in] start timestamp of first window (e.g. 1405124592)
+ * @param[in] window length in seconds; > 0
+ * @param[in] number of windows
+ * @param[in] from node id. 0 = yauid_get_min_node_id()
+ * @param[in] to node id. 0 = yauid_get_max_node_id()
+ * @param[out] array of count min and max yauid keys
+ *
+ * @return number of filled windows; less than count if timestamp limit is exceeded
+ */
+size_t yauid_get_period_keys_by_grid(time_t start, time_t step, size_t count,
+                                     unsigned long long int from_node_id,
+                                     unsigned long long int to_node_id,
+                                     yauid_period_key *pkeys);
+
+/**
+ * Find window for every key.
+ * Consecutive keys of one window (sorted or clustered input) are resolved without search
+ *
+ * @param[in] sorted, non-overlapping windows (see yauid_get_period_keys_by_grid)
+ * @param[in] number of windows
+ * @param[in] keys
+ * @param[in] number of keys
+ * @param[out] array of count window indexes; -1 if key is not in any window
+ */
+void yauid_classify_keys(const yauid_period_key *pkeys, size_t pcount,
+                         const hkey_t *keys, size_t count, long *idx);
+
+/**
+ * Init validation rules: time window around now, all node ids, no bitmap.
+ * Fields of yauid_validate can be changed after init
+ *
+ * @param[out] rules
+ * @param[in] current timestamp; 0 = time(NULL)
+ * @param[in] seconds allowed in the past
+ * @param[in] seconds allowed in the future
+ */
+void yauid_validate_init(yauid_validate *rules, time_t now, time_t past, time_t future);
+
+/**
+ * Check keys: timestamp and node id within rules, node id in bitmap (if set), inc id > 0.
+ * No key is valid if a range of rules is inverted (from > to).
+ * On x86-64 CPUs with AVX2 (checked at run time) full 64-key words are checked 4 keys
+ * at a time, about 5 GB/s of keys without bitmap (memcpy: about 6 GB/s); otherwise
+ * keys are checked one by one, about 2.4 GB/s
+ *
+ * @param[in] rules
+ * @param[in] keys
+ * @param[in] number of keys
+ * @param[out] bitmask of (count + 63) / 64 words; bit (i & 63) of word i / 64 is set if key i is valid
+ * @return number of valid keys
+ */
+size_t yauid_validate_batch(const yauid_validate *rules, const hkey_t *keys, size_t count, uint64_t *mask);
+
+/**
+ * Copy valid keys (see yauid_validate_batch) preserving order. valid may be equal to keys
+ *
+ * @param[in] rules
+ * @param[in] keys
+ * @param[in] number of keys
+ * @param[out] array for valid keys; count items is enough
+ * @return number of valid keys
+ */
+size_t yauid_validate_compact(const yauid_validate *rules, const hkey_t *keys, size_t count, hkey_t *valid);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
+
@@ -0,0 +1,101 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef yauid_yauid_dup_h
+#define yauid_yauid_dup_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <yauid.h>
+
+/***********************************************************************************
+ *
+ * Duplicate keys detector
+ *
+ * Keeps every key of a ring of recent seconds in a hash set per second. A key seen
+ * twice means two hosts issue keys with one node id (or a lock file was lost).
+ * Memory is bounded by seconds * keys_per_second * 2 keys.
+ *
+ ***********************************************************************************/
+
+struct yauid_dup_second {
+    uint64_t timestamp;      /* 0 = free slot */
+    size_t   used;
+    hkey_t  *keys;           /* open addressing, 0 = free */
+}
+typedef yauid_dup_second;
+
+struct yauid_dup {
+    size_t seconds;          /* ring size */
+    size_t capacity;         /* hash set size per second, power of 2 */
+    size_t limit;            /* max keys per second */
+    
+    yauid_dup_second *ring;
+    hkey_t *keys;
+    
+    uint64_t *node_dups;     /* duplicates per node */
+    
+    uint64_t count;          /* keys checked */
+    uint64_t dups;
+    uint64_t late;           /* keys older than the ring, not checked */
+    uint64_t overflow;       /* keys over limit of a second, not checked */
+}
+typedef yauid_dup;
+
+/**
+ * Create a new duplicate detector
+ *
+ * @param[in] number of recent seconds to keep; > 0
+ * @param[in] max keys per second (all nodes) to keep
+ * @return yauid_dup structure or NULL if memory can't be allocated
+ */
+yauid_dup * yauid_dup_create(size_t seconds, size_t keys_per_second);
+
+/**
+ * Frees all allocated resources
+ *
+ * @param[in] yauid_dup
+ */
+void yauid_dup_destroy(yauid_dup* dup);
+
+/**
+ * Check keys against keys seen before and remember them
+ *
+ * @param[in] yauid_dup
+ * @param[in] keys
+ * @param[in] number of keys
+ * @return number of duplicate keys found
+ */
+size_t yauid_dup_feed(yauid_dup* dup, const hkey_t *keys, size_t count);
+
+/**
+ * Get node ids with duplicate keys
+ *
+ * @param[in] yauid_dup
+ * @param[out] NULL or array for node ids
+ * @param[in] array size
+ * @return number of node ids with duplicates (may be greater than size)
+ */
+size_t yauid_dup_nodes(yauid_dup* dup, unsigned long *node_ids, size_t size);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
+
@@ -0,0 +1,160 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef yauid_yauid_index_h
+#define yauid_yauid_index_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <yauid.h>
+
+/***********************************************************************************
+ *
+ * Sorted key index file
+ *
+ * Read-only file for mmap: header, sorted unique keys, directory.
+ * Directory entry b is the position of the first key with
+ * (timestamp - from) >> shift >= b, so a lookup jumps to the keys of its seconds
+ * and searches only there. Values are in host byte order.
+ *
+ ***********************************************************************************/
+
+#define YAUID_INDEX_MAGIC   0x3158494449554159ULL /* "YAUIDIX1" */
+#define YAUID_INDEX_VERSION 1
+
+struct yauid_index_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t shift;          /* directory bucket = (timestamp - from) >> shift */
+    uint64_t endian;         /* YAUID_STATE_ENDIAN */
+    uint64_t count;          /* number of keys */
+    uint64_t from;           /* timestamp of first key */
+    uint64_t buckets;        /* directory has buckets + 1 entries */
+    uint8_t  bit_timestamp;
+    uint8_t  bit_node;
+    uint8_t  bit_inc;
+    uint8_t  reserved[13];
+}
+typedef yauid_index_header;
+
+struct yauid_index {
+    void  *map;
+    size_t map_size;
+    
+    const hkey_t   *keys;    /* count sorted keys */
+    const uint64_t *dir;     /* buckets + 1 entries */
+    size_t   count;
+    uint64_t from;
+    uint64_t buckets;
+    uint32_t shift;
+    
+    yauid_status_t error;
+}
+typedef yauid_index;
+
+struct yauid_index_builder;
+typedef struct yauid_index_builder yauid_index_builder;
+
+/**
+ * Open index file
+ *
+ * @param[in] file path
+ * @return yauid_index structure (see yauid_index.error) or NULL if memory can't be allocated
+ */
+yauid_index * yauid_index_open(const char *filepath);
+
+/**
+ * Unmap file and free all allocated resources
+ *
+ * @param[in] yauid_index
+ */
+void yauid_index_close(yauid_index* index);
+
+/**
+ * Check that key is in index
+ *
+ * @param[in] yauid_index
+ * @param[in] yauid key
+ * @return 1 if found or 0
+ */
+int yauid_index_contains(yauid_index* index, hkey_t key);
+
+/**
+ * Check keys; loads of directory and keys for later lookups are prefetched
+ *
+ * @param[in] yauid_index
+ * @param[in] keys
+ * @param[in] number of keys
+ * @param[out] array of count results: 1 if found or 0
+ * @return number of found keys
+ */
+size_t yauid_index_contains_batch(yauid_index* index, const hkey_t *keys, size_t count, uint8_t *found);
+
+/**
+ * Find keys from min to max (e.g. yauid_period_key); keys are index->keys[*first] and next
+ *
+ * @param[in] yauid_index
+ * @param[in] min key
+ * @param[in] max key
+ * @param[out] position of first key
+ * @return number of keys
+ */
+size_t yauid_index_range(yauid_index* index, hkey_t min, hkey_t max, size_t *first);
+
+/**
+ * Create index builder. Keys may come in any order and with duplicates; when
+ * memory_keys keys are collected they are sorted and spilled to a temporary file
+ *
+ * @param[in] index file path
+ * @param[in] max keys in memory; 0 = 16M keys
+ * @return yauid_index_builder or NULL if memory can't be allocated
+ */
+yauid_index_builder * yauid_index_builder_create(const char *filepath, size_t memory_keys);
+
+/**
+ * Add keys
+ *
+ * @param[in] yauid_index_builder
+ * @param[in] keys
+ * @param[in] number of keys
+ * @return YAUID_OK if successful or error code
+ */
+yauid_status_t yauid_index_builder_add(yauid_index_builder* builder, const hkey_t *keys, size_t count);
+
+/**
+ * Merge all keys and write index file. Keys merged from spilled runs are counted
+ * against keys written to them; on a read error or a short run the file is removed
+ *
+ * @param[in] yauid_index_builder
+ * @return YAUID_OK if successful or error code
+ */
+yauid_status_t yauid_index_builder_finish(yauid_index_builder* builder);
+
+/**
+ * Free all allocated resources and remove temporary files
+ *
+ * @param[in] yauid_index_builder
+ */
+void yauid_index_builder_destroy(yauid_index_builder* builder);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
+
@@ -0,0 +1,128 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef yauid_yauid_merge_h
+#define yauid_yauid_merge_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <yauid.h>
+
+/***********************************************************************************
+ *
+ * K-way merge of sorted key streams (loser tree)
+ *
+ ***********************************************************************************/
+
+/**
+ * Reader of sorted keys: fill buffer with up to count next keys
+ *
+ * @param[in] reader context
+ * @param[out] buffer
+ * @param[in] buffer size
+ * @return number of keys; 0 = end of stream
+ */
+typedef size_t (*yauid_merge_read_f)(void *ctx, hkey_t *keys, size_t count);
+
+struct yauid_merge;
+typedef struct yauid_merge yauid_merge;
+
+/**
+ * Create a new merge
+ *
+ * @param[in] 1 = drop duplicate keys, 0 = keep
+ * @return yauid_merge structure or NULL if memory can't be allocated
+ */
+yauid_merge * yauid_merge_create(int dedup);
+
+/**
+ * Frees all allocated resources. Sources are not closed
+ *
+ * @param[in] yauid_merge
+ */
+void yauid_merge_destroy(yauid_merge* merge);
+
+/**
+ * Add sorted stream. Sources must be added before first yauid_merge_read
+ *
+ * @param[in] yauid_merge
+ * @param[in] reader; yauid_merge_read with other merge as context is a reader too
+ * @param[in] reader context
+ * @return YAUID_OK if successful or error code
+ */
+yauid_status_t yauid_merge_add_reader(yauid_merge* merge, yauid_merge_read_f read, void *ctx);
+
+/**
+ * Add sorted array. Array is read in place and must live until merge is done
+ *
+ * @param[in] yauid_merge
+ * @param[in] keys
+ * @param[in] number of keys
+ * @return YAUID_OK if successful or error code
+ */
+yauid_status_t yauid_merge_add_array(yauid_merge* merge, const hkey_t *keys, size_t count);
+
+/**
+ * Add file of sorted keys (raw hkey_t array in host byte order)
+ *
+ * @param[in] yauid_merge
+ * @param[in] opened file; read from current position
+ * @return YAUID_OK if successful or error code
+ */
+yauid_status_t yauid_merge_add_file(yauid_merge* merge, FILE *fh);
+
+/**
+ * Get next keys of merged stream
+ *
+ * @param[in] yauid_merge
+ * @param[out] buffer
+ * @param[in] buffer size
+ * @return number of keys; 0 = all sources ended or error, see yauid_merge_get_error
+ */
+size_t yauid_merge_read(yauid_merge* merge, hkey_t *keys, size_t count);
+
+/**
+ * Get error of merge: memory can't be allocated on first read, read error of a file
+ * (yauid_merge_add_file) or of a nested merge. Check it when yauid_merge_read returns 0
+ *
+ * @param[in] yauid_merge
+ * @return YAUID_OK or error code
+ */
+yauid_status_t yauid_merge_get_error(yauid_merge* merge);
+
+/**
+ * Merge sorted arrays with several threads. Work is split by timestamp (seconds) of
+ * key quantiles, so every thread merges its own range of every array
+ *
+ * @param[in] arrays of sorted keys
+ * @param[in] number of keys in every array
+ * @param[in] number of arrays
+ * @param[out] merged keys; sum of counts items is enough
+ * @param[in] 1 = drop duplicate keys, 0 = keep
+ * @param[in] number of threads; 0 or 1 = merge in caller thread
+ * @return number of merged keys; 0 if any error
+ */
+size_t yauid_merge_arrays(const hkey_t **arrays, const size_t *counts, size_t size,
+                          hkey_t *keys, int dedup, unsigned int threads);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
+
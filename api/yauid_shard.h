@@ -0,0 +1,88 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef yauid_yauid_shard_h
+#define yauid_yauid_shard_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <yauid.h>
+
+/***********************************************************************************
+ *
+ * Sharding of keys across partitions
+ *
+ * key % shards is skewed: the low bits are inc id, which restarts at 1 every second
+ * and rarely grows high. The hash mixes timestamp, node id and inc id fields first.
+ *
+ ***********************************************************************************/
+
+/**
+ * Get 64 bit hash of key; all fields affect all bits
+ *
+ * @param[in] yauid key
+ * @return hash
+ */
+uint64_t yauid_shard_hash(hkey_t key);
+
+/**
+ * Get shard of key: hash scaled to the range without division
+ *
+ * @param[in] yauid key
+ * @param[in] number of shards; > 0
+ * @return shard from 0 to shards - 1
+ */
+uint32_t yauid_shard(hkey_t key, uint32_t shards);
+
+/**
+ * Get shard of key by jump consistent hash (Lamping, Veach): when shards grows
+ * from n to n + 1 only 1 / (n + 1) of keys move, all to the new shard
+ *
+ * @param[in] yauid key
+ * @param[in] number of shards; > 0
+ * @return shard from 0 to shards - 1
+ */
+uint32_t yauid_shard_jump(hkey_t key, uint32_t shards);
+
+/**
+ * Get shards of keys (see yauid_shard). On x86-64 CPUs with AVX2 (checked at run time)
+ * 4 keys are hashed at a time, otherwise keys are hashed one by one
+ *
+ * @param[in] keys
+ * @param[in] number of keys
+ * @param[in] number of shards; > 0
+ * @param[out] array of count shards
+ */
+void yauid_shard_batch(const hkey_t *keys, size_t count, uint32_t shards, uint32_t *out);
+
+/**
+ * Get shards of keys (see yauid_shard_jump). Scalar loop: the jump loop is data dependent
+ *
+ * @param[in] keys
+ * @param[in] number of keys
+ * @param[in] number of shards; > 0
+ * @param[out] array of count shards
+ */
+void yauid_shard_jump_batch(const hkey_t *keys, size_t count, uint32_t shards, uint32_t *out);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
+
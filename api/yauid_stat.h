@@ -0,0 +1,131 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef yauid_yauid_stat_h
+#define yauid_yauid_stat_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <yauid.h>
+
+/***********************************************************************************
+ *
+ * Streaming key statistics
+ *
+ * Counts keys per node and, for a ring of recent seconds, the max inc of every node
+ * (= keys issued by the node in that second). When a second leaves the ring its
+ * per-node max inc goes to a log2 histogram. Memory is bounded by
+ * seconds * nodes_per_second entries plus two arrays of NUMBER_LIMIT_NODE + 1 items.
+ *
+ ***********************************************************************************/
+
+/* bucket b holds max inc from 2^b to 2^(b + 1) - 1 */
+#define YAUID_STAT_HIST_SIZE (BIT_LIMIT_INC + 1)
+
+struct yauid_stat_entry {
+    uint32_t node_id;
+    uint32_t max_inc;
+    uint32_t count;          /* 0 = free entry */
+}
+typedef yauid_stat_entry;
+
+struct yauid_stat_second {
+    uint64_t timestamp;      /* 0 = free slot */
+    uint64_t keys;
+    size_t   used;
+    yauid_stat_entry *entries;
+}
+typedef yauid_stat_second;
+
+struct yauid_stat {
+    size_t seconds;          /* ring size */
+    size_t nodes;            /* entries per second, power of 2 */
+    
+    yauid_stat_second *ring;
+    yauid_stat_entry  *entries;
+    
+    uint64_t *node_keys;     /* keys per node */
+    uint32_t *node_peak;     /* max inc per node */
+    
+    uint64_t hist[YAUID_STAT_HIST_SIZE];
+    
+    uint64_t keys;
+    uint64_t seconds_done;   /* seconds moved to histogram */
+    uint64_t late;           /* keys older than the ring */
+    uint64_t overflow;       /* keys of nodes that did not fit into a second */
+    uint64_t peak_keys;      /* max keys in one second, all nodes */
+    uint64_t peak_timestamp;
+}
+typedef yauid_stat;
+
+/**
+ * Create a new statistics aggregator
+ *
+ * @param[in] number of recent seconds to keep; > 0
+ * @param[in] max nodes per second; rounded up to power of 2
+ * @return yauid_stat structure or NULL if memory can't be allocated
+ */
+yauid_stat * yauid_stat_create(size_t seconds, size_t nodes_per_second);
+
+/**
+ * Frees all allocated resources
+ *
+ * @param[in] yauid_stat
+ */
+void yauid_stat_destroy(yauid_stat* stat);
+
+/**
+ * Count keys. Keys may come out of order within the ring of recent seconds
+ *
+ * @param[in] yauid_stat
+ * @param[in] keys
+ * @param[in] number of keys
+ */
+void yauid_stat_feed(yauid_stat* stat, const hkey_t *keys, size_t count);
+
+/**
+ * Add statistics of other aggregator (e.g. other shard). Source is not changed.
+ * Seconds in the rings are combined per node; a second that has already left the ring
+ * of both aggregators is counted in the histogram twice
+ *
+ * @param[in] destination yauid_stat
+ * @param[in] source yauid_stat
+ */
+void yauid_stat_merge(yauid_stat* stat, const yauid_stat* from);
+
+/**
+ * Move all seconds of the ring to histogram
+ *
+ * @param[in] yauid_stat
+ */
+void yauid_stat_flush(yauid_stat* stat);
+
+/**
+ * Print summary: totals, max inc histogram and per node keys and peaks
+ *
+ * @param[in] yauid_stat
+ * @param[in] output stream
+ */
+void yauid_stat_dump(yauid_stat* stat, FILE *fh);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
+
@@ -0,0 +1,76 @@
+/*
+ Copyright (c) 2014 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdio.h>
+#include <yauid.h>
+
+#define KEYS 100000L
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void run(const yauid_backend *backend, const char *filepath_key)
+{
+    double start = now_sec();
+    yauid* yaobj = yauid_init_backend(backend, filepath_key, NULL);
+    
+    if(yaobj == NULL || yauid_get_error_code(yaobj) != YAUID_OK)
+    {
+        printf("%s: can't create object\n", backend->name);
+        yauid_destroy(yaobj);
+        return;
+    }
+    
+    yauid_set_node_id(yaobj, 12);
+    yauid_set_sleep_usec(yaobj, 1000);
+    
+    double init = now_sec() - start;
+    
+    /* memory backend waits for the next second on the first key */
+    yauid_get_key(yaobj);
+    
+    start = now_sec();
+    
+    long i;
+    for(i = 0; i < KEYS; i++)
+    {
+        if(yauid_get_key(yaobj) == (hkey_t)(0)) {
+            printf("%s\n", yauid_get_error_text_by_code(yauid_get_error_code(yaobj)));
+            break;
+        }
+    }
+    
+    double time = now_sec() - start;
+    
+    printf("%-8s init %7.1f usec; %ld keys: %10.0f keys/s, %6.3f usec/key\n", backend->name,
+           init * 1e6, i, (double)i / time, time / (double)i * 1e6);
+    
+    yauid_destroy(yaobj);
+}
+
+int main(int argc, const char * argv[])
+{
+    run(&yauid_backend_file, "lock.yauid");
+    run(&yauid_backend_memory, NULL);
+    
+    return 0;
+}
+
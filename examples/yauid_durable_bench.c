@@ -0,0 +1,122 @@
+/*
+ Copyright (c) 2014 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <yauid.h>
+
+#define THREADS         8
+#define KEYS_PER_THREAD 500
+
+static yauid* yaobj;
+static double latency[THREADS * KEYS_PER_THREAD];
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void * worker(void *arg)
+{
+    double *lat = (double *)arg;
+    size_t i;
+    
+    for(i = 0; i < KEYS_PER_THREAD; i++)
+    {
+        double start = now_sec();
+        
+        if(yauid_get_key(yaobj) == (hkey_t)(0)) {
+            printf("%s\n", yauid_get_error_text_by_code(yauid_get_error_code(yaobj)));
+            break;
+        }
+        
+        lat[i] = now_sec() - start;
+    }
+    
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double da = *((const double *)a), db = *((const double *)b);
+    return (da > db) - (da < db);
+}
+
+static void run(int durable, useconds_t interval_usec)
+{
+    pthread_t threads[THREADS];
+    size_t i, total = THREADS * KEYS_PER_THREAD;
+    
+    yauid_set_durable(yaobj, durable, interval_usec);
+    memset(latency, 0, sizeof(latency));
+    
+    double start = now_sec();
+    
+    /* without durable mode the handle is not shared: one thread only */
+    if(durable) {
+        for(i = 0; i < THREADS; i++)
+            pthread_create(&threads[i], NULL, worker, &latency[i * KEYS_PER_THREAD]);
+        
+        for(i = 0; i < THREADS; i++)
+            pthread_join(threads[i], NULL);
+    }
+    else {
+        for(i = 0; i < THREADS; i++)
+            worker(&latency[i * KEYS_PER_THREAD]);
+    }
+    
+    double time = now_sec() - start, sum = 0;
+    
+    for(i = 0; i < total; i++)
+        sum += latency[i];
+    
+    qsort(latency, total, sizeof(double), cmp_double);
+    
+    if(durable)
+        printf("durable, interval %6u usec: ", (unsigned int)interval_usec);
+    else
+        printf("not durable:                   ");
+    
+    printf("%9.0f keys/s; latency avg %8.1f usec, p99 %8.1f usec\n", (double)total / time,
+           sum / (double)total * 1e6, latency[total * 99 / 100] * 1e6);
+}
+
+int main(int argc, const char * argv[])
+{
+    yaobj = yauid_init("lock.yauid", NULL);
+    
+    if(yaobj == NULL || yauid_get_error_code(yaobj) != YAUID_OK)
+    {
+        printf("Can't create object\n");
+        return 0;
+    }
+    
+    yauid_set_node_id(yaobj, 12);
+    
+    run(0, 0);
+    run(1, 0);
+    run(1, 100);
+    run(1, 1000);
+    run(1, 5000);
+    
+    yauid_destroy(yaobj);
+    
+    return 0;
+}
+
@@ -0,0 +1,133 @@
+/*
+ Copyright (c) 2014 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdio.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <yauid.h>
+
+#define RUNS 2000L
+
+typedef yauid * (*init_f)(const char *filepath_key, const char *filepath_node_id);
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int once(init_f init)
+{
+    yauid* yaobj = init("lock.yauid", "node.id");
+    
+    int result = (yaobj && yauid_get_key(yaobj)) ? 0 : 1;
+    
+    yauid_destroy(yaobj);
+    
+    return result;
+}
+
+/* syscalls of one "init + 1 key + destroy" in a traced child */
+static long count_syscalls(init_f init)
+{
+    pid_t pid = fork();
+    
+    if(pid == 0)
+    {
+        if(ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1)
+            _exit(2);
+        
+        raise(SIGSTOP);
+        _exit(once(init));
+    }
+    
+    int status;
+    long stops = 0;
+    
+    if(pid < 0 || waitpid(pid, &status, 0) != pid || WIFSTOPPED(status) == 0)
+        return -1;
+    
+    for(;;)
+    {
+        if(ptrace(PTRACE_SYSCALL, pid, NULL, NULL) == -1 || waitpid(pid, &status, 0) != pid)
+            return -1;
+        
+        if(WIFEXITED(status))
+            break;
+        
+        stops++;
+    }
+    
+    if(WEXITSTATUS(status))
+        return -1;
+    
+    /* entry and exit stop per call; exit_group() has entry stop only */
+    return (stops - 1) / 2;
+}
+
+static void run(const char *name, init_f init)
+{
+    long syscalls = count_syscalls(init);
+    
+    double start = now_sec();
+    
+    long i;
+    for(i = 0; i < RUNS; i++)
+    {
+        if(once(init)) {
+            printf("%s: can't get key\n", name);
+            return;
+        }
+    }
+    
+    double time = now_sec() - start;
+    
+    printf("%-18s %3ld syscalls, %7.2f usec per init + 1 key + destroy\n", name,
+           syscalls, time / (double)RUNS * 1e6);
+}
+
+int main(int argc, const char * argv[])
+{
+    unsetenv(YAUID_NODE_ID_ENV);
+    
+    /* lock file exists and malloc is set up before counting */
+    once(yauid_init);
+    
+    run("yauid_init", yauid_init);
+    
+    printf("%-18s %3ld syscalls (node id from file)\n", "yauid_init_lazy", count_syscalls(yauid_init_lazy));
+    
+    /* node id is cached in the process from now; exported for child processes */
+    yauid* yaobj = yauid_init_lazy("lock.yauid", "node.id");
+    
+    if(yaobj == NULL || yauid_get_error_code(yaobj) != YAUID_OK ||
+       yauid_export_node_id(yaobj, "node.id") != YAUID_OK)
+    {
+        printf("can't read node.id\n");
+        yauid_destroy(yaobj);
+        return 1;
+    }
+    
+    yauid_destroy(yaobj);
+    
+    run("yauid_init_lazy", yauid_init_lazy);
+    
+    return 0;
+}
+
@@ -0,0 +1,157 @@
+/*
+ Copyright (c) 2014 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdio.h>
+#include <yauid.h>
+#include <yauid_merge.h>
+
+#define NODES         32
+#define KEYS_PER_NODE 1000000L
+#define THREADS       4
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* naive binary heap of (key, source) for comparison */
+static size_t heap_merge(const hkey_t **arrays, const size_t *counts, size_t size, hkey_t *keys)
+{
+    size_t *heap = malloc(sizeof(size_t) * size);
+    size_t *pos  = calloc(size, sizeof(size_t));
+    size_t i, len = 0, heap_len = 0;
+    
+    for(i = 0; i < size; i++) {
+        if(counts[i] == 0)
+            continue;
+        
+        size_t child = heap_len++;
+        
+        while(child && arrays[i][0] < arrays[ heap[(child - 1) / 2] ][ pos[ heap[(child - 1) / 2] ] ]) {
+            heap[child] = heap[(child - 1) / 2];
+            child = (child - 1) / 2;
+        }
+        
+        heap[child] = i;
+    }
+    
+    while(heap_len)
+    {
+        size_t top = heap[0];
+        keys[len++] = arrays[top][ pos[top]++ ];
+        
+        if(pos[top] == counts[top])
+            top = heap[--heap_len];
+        
+        size_t parent = 0;
+        
+        for(;;)
+        {
+            size_t child = parent * 2 + 1;
+            if(child >= heap_len)
+                break;
+            
+            if(child + 1 < heap_len && arrays[ heap[child + 1] ][ pos[ heap[child + 1] ] ] < arrays[ heap[child] ][ pos[ heap[child] ] ])
+                child++;
+            
+            if(arrays[top][ pos[top] ] <= arrays[ heap[child] ][ pos[ heap[child] ] ])
+                break;
+            
+            heap[parent] = heap[child];
+            parent = child;
+        }
+        
+        if(heap_len)
+            heap[parent] = top;
+    }
+    
+    free(heap);
+    free(pos);
+    
+    return len;
+}
+
+int main(int argc, const char * argv[])
+{
+    const hkey_t *arrays[NODES];
+    size_t counts[NODES];
+    size_t i, j, total = NODES * KEYS_PER_NODE;
+    
+    srand(1);
+    
+    /* every node issues a random number of keys per second */
+    for(i = 0; i < NODES; i++)
+    {
+        hkey_t *keys = malloc(sizeof(hkey_t) * KEYS_PER_NODE);
+        time_t timestamp = 1405124592;
+        size_t inc = 0, per_sec = 1 + rand() % 2000;
+        
+        for(j = 0; j < KEYS_PER_NODE; j++)
+        {
+            if(++inc > per_sec) {
+                timestamp++;
+                inc = 1;
+                per_sec = 1 + rand() % 2000;
+            }
+            
+            keys[j] = yauid_get_key_by_timestamp(timestamp, i + 1, inc);
+        }
+        
+        arrays[i] = keys;
+        counts[i] = KEYS_PER_NODE;
+    }
+    
+    hkey_t *heap_keys = malloc(sizeof(hkey_t) * total);
+    hkey_t *keys = malloc(sizeof(hkey_t) * total);
+    
+    /* touch output pages before timing */
+    memset(heap_keys, 0, sizeof(hkey_t) * total);
+    memset(keys, 0, sizeof(hkey_t) * total);
+    
+    double start = now_sec();
+    size_t len = heap_merge(arrays, counts, NODES, heap_keys);
+    double heap_time = now_sec() - start;
+    
+    printf("binary heap:      %zu keys; %.1f Mkeys/s\n", len, (double)len / heap_time / 1e6);
+    
+    start = now_sec();
+    len = yauid_merge_arrays(arrays, counts, NODES, keys, 0, 1);
+    double time = now_sec() - start;
+    
+    printf("loser tree:       %zu keys; %.1f Mkeys/s; %s\n", len, (double)len / time / 1e6,
+           (memcmp(keys, heap_keys, sizeof(hkey_t) * total) == 0) ? "equal" : "DIFFERENT");
+    
+    memset(keys, 0, sizeof(hkey_t) * total);
+    
+    start = now_sec();
+    len = yauid_merge_arrays(arrays, counts, NODES, keys, 0, THREADS);
+    time = now_sec() - start;
+    
+    printf("loser tree x%d:    %zu keys; %.1f Mkeys/s; %s\n", THREADS, len, (double)len / time / 1e6,
+           (memcmp(keys, heap_keys, sizeof(hkey_t) * total) == 0) ? "equal" : "DIFFERENT");
+    
+    for(i = 0; i < NODES; i++)
+        free((void *)arrays[i]);
+    
+    free(heap_keys);
+    free(keys);
+    
+    return 0;
+}
+
@@ -0,0 +1,131 @@
+/*
+ Copyright (c) 2014 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdio.h>
+#include <yauid.h>
+#include <yauid_shard.h>
+
+#define KEYS   4000000L
+#define SHARDS 24
+
+/* chi2 critical value for df = SHARDS - 1 = 23 at p = 0.001 */
+#define CHI2_CRITICAL 49.728
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double report(const char *name, const uint32_t *shards, size_t count, double time)
+{
+    uint64_t hist[SHARDS] = {0};
+    size_t i;
+    
+    for(i = 0; i < count; i++)
+        hist[ shards[i] ]++;
+    
+    double expected = (double)count / SHARDS, chi2 = 0;
+    uint64_t min = hist[0], max = hist[0];
+    
+    for(i = 0; i < SHARDS; i++) {
+        chi2 += ((double)hist[i] - expected) * ((double)hist[i] - expected) / expected;
+        
+        if(hist[i] < min) min = hist[i];
+        if(hist[i] > max) max = hist[i];
+    }
+    
+    printf("%-12s %8.1f Mkeys/s; max/min shard %6.3f; chi2 %12.1f (df %d)\n", name,
+           (double)count / time / 1e6, (double)max / (double)(min ? min : 1), chi2, SHARDS - 1);
+    
+    return chi2;
+}
+
+int main(int argc, const char * argv[])
+{
+    hkey_t *keys = malloc(sizeof(hkey_t) * KEYS);
+    uint32_t *shards = malloc(sizeof(uint32_t) * KEYS);
+    uint32_t *grown  = malloc(sizeof(uint32_t) * KEYS);
+    size_t i = 0;
+    
+    srand(1);
+    
+    /* realistic stream: 200 nodes, most seconds of a node are sparse, some are busy */
+    time_t timestamp = 1405124592;
+    
+    while(i < KEYS)
+    {
+        unsigned long node_id;
+        
+        for(node_id = 1; node_id <= 200 && i < KEYS; node_id++)
+        {
+            size_t inc, per_sec = (rand() % 100 < 90) ? (size_t)(rand() % 4) : (size_t)(rand() % 3000);
+            
+            for(inc = 1; inc <= per_sec && i < KEYS; inc++)
+                keys[i++] = yauid_get_key_by_timestamp(timestamp, node_id, inc);
+        }
+        
+        timestamp++;
+    }
+    
+    double start = now_sec();
+    for(i = 0; i < KEYS; i++)
+        shards[i] = (uint32_t)(keys[i] % SHARDS);
+    report("key % N", shards, KEYS, now_sec() - start);
+    
+    start = now_sec();
+    yauid_shard_batch(keys, KEYS, SHARDS, shards);
+    double chi2_shard = report("shard", shards, KEYS, now_sec() - start);
+    
+    start = now_sec();
+    yauid_shard_jump_batch(keys, KEYS, SHARDS, shards);
+    double chi2_jump = report("shard jump", shards, KEYS, now_sec() - start);
+    
+    /* resharding: N -> N + 1 */
+    yauid_shard_jump_batch(keys, KEYS, SHARDS + 1, grown);
+    
+    size_t moved = 0, wrong = 0;
+    for(i = 0; i < KEYS; i++) {
+        if(shards[i] != grown[i]) {
+            moved++;
+            wrong += (grown[i] != SHARDS);
+        }
+    }
+    
+    printf("jump %d -> %d: %.2f%% keys moved (ideal %.2f%%), %zu not to the new shard\n", SHARDS, SHARDS + 1,
+           (double)moved * 100.0 / KEYS, 100.0 / (SHARDS + 1), wrong);
+    
+    free(keys);
+    free(shards);
+    free(grown);
+    
+    int failed = 0;
+    
+    if(chi2_shard > CHI2_CRITICAL || chi2_jump > CHI2_CRITICAL) {
+        printf("FAIL: chi2 above %.3f (df %d, p = 0.001)\n", CHI2_CRITICAL, SHARDS - 1);
+        failed = 1;
+    }
+    
+    if(wrong) {
+        printf("FAIL: %zu keys moved not to the new shard\n", wrong);
+        failed = 1;
+    }
+    
+    return failed;
+}
+
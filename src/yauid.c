@@ -15,6 +15,13 @@
  */
 
 #include <yauid.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include "yauid_prefetch.h"
+#include "yauid_durable.h"
+#include "yauid_probe.h"
 
 #ifdef ENVIRONMENT32
 #error 64 bit system only
@@ -36,9 +43,434 @@ char error_text[][64] = {
     "Can't write key to file",
     "Can't flush key to file",
     "Number of attempts to get the key exhausted",
-    "Can't create object"
+    "Can't create object",
+    "Can't allocate memory for key file path",
+    "Unknown format of key file",
+    "Unsupported version of key file",
+    "Key file created with other bit limits",
+    "Key file created with other byte order",
+    "Key file checksum mismatch",
+    "Can't start prefetch thread",
+    "Can't add source to started merge",
+    "Can't sync key file",
+    "State was changed by other thread",
+    "Can't open index file",
+    "Unknown format of index file",
+    "Can't write index file",
+    "Wrong timestamp range of backfill",
+    "Backfill node id must differ from node id",
+    "Live key history is unknown, set live seconds explicitly"
 };
 
+/* probes: see yauid_probe.h */
+YAUID_PROBE_DEFINE(lock_acquire);   /* fd, wait ns */
+YAUID_PROBE_DEFINE(lock_release);   /* fd, hold ns */
+YAUID_PROBE_DEFINE(clock_read);     /* timestamp */
+YAUID_PROBE_DEFINE(key_issue);      /* first key, count */
+YAUID_PROBE_DEFINE(keys_ended);     /* last key, timestamp */
+YAUID_PROBE_DEFINE(retry_sleep);    /* attempt, sleep usec */
+YAUID_PROBE_DEFINE(io_error);       /* fd, status, errno */
+
+#ifdef YAUID_WITH_USDT
+static __thread uint64_t yauid_probe_lock_ns;
+#endif
+
+typedef char yauid_state_size_check[(sizeof(yauid_state) == YAUID_STATE_SLOT_SIZE * 4) ? 1 : -1];
+
+/***********************************************************************************
+ *
+ * State file
+ *
+ ***********************************************************************************/
+
+static uint64_t yauid_state_checksum(const void *slot)
+{
+    /* FNV-1a over the slot without trailing checksum */
+    const unsigned char *data = (const unsigned char *)slot;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+    
+    for(i = 0; i < YAUID_STATE_SLOT_SIZE - sizeof(uint64_t); i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    
+    return hash;
+}
+
+/* counter checksum is taken with key_copy in place of key, see yauid_state_counter */
+static uint64_t yauid_state_counter_checksum(const yauid_state_counter *counter)
+{
+    yauid_state_counter tmp;
+    
+    memcpy(&tmp, counter, sizeof(yauid_state_counter));
+    tmp.key = tmp.key_copy;
+    
+    return yauid_state_checksum(&tmp);
+}
+
+static void yauid_state_header_init(yauid_state_header *header)
+{
+    memset(header, 0, sizeof(yauid_state_header));
+    
+    header->magic         = YAUID_STATE_MAGIC;
+    header->version       = YAUID_STATE_VERSION;
+    header->size          = sizeof(yauid_state);
+    header->endian        = YAUID_STATE_ENDIAN;
+    header->bit_limit     = BIT_LIMIT;
+    header->bit_timestamp = BIT_LIMIT_TIMESTAMP;
+    header->bit_node      = BIT_LIMIT_NODE;
+    header->bit_inc       = BIT_LIMIT_INC;
+    header->min_node_id   = LIMIT_MIN_NODE_ID;
+    header->checksum      = yauid_state_checksum(header);
+}
+
+static void yauid_state_init(yauid* yaobj, yauid_state *state, hkey_t key)
+{
+    memset(state, 0, sizeof(yauid_state));
+    memcpy(&state->header, &yaobj->state_header, sizeof(yauid_state_header));
+    
+    state->counter.key = key;
+    
+    if(key) {
+        state->stats.keys    = 1;
+        state->stats.seconds = 1;
+        state->stats.first   = yauid_get_timestamp(key);
+        state->stats.last    = state->stats.first;
+        state->stats.flags   = YAUID_STATE_STATS_PARTIAL;
+    }
+}
+
+static yauid_status_t yauid_state_check_header(yauid* yaobj, const yauid_state_header *header)
+{
+    if(memcmp(header, &yaobj->state_header, sizeof(yauid_state_header)) == 0)
+        return YAUID_OK;
+    
+    if(header->magic == __builtin_bswap64(YAUID_STATE_MAGIC))
+        return YAUID_ERROR_STATE_ENDIAN;
+    if(header->magic != YAUID_STATE_MAGIC)
+        return YAUID_ERROR_STATE_FORMAT;
+    if(header->version != YAUID_STATE_VERSION)
+        return YAUID_ERROR_STATE_VERSION;
+    if(header->endian != YAUID_STATE_ENDIAN)
+        return YAUID_ERROR_STATE_ENDIAN;
+    if(header->size != sizeof(yauid_state)   ||
+       header->bit_limit     != BIT_LIMIT     ||
+       header->bit_timestamp != BIT_LIMIT_TIMESTAMP ||
+       header->bit_node      != BIT_LIMIT_NODE ||
+       header->bit_inc       != BIT_LIMIT_INC  ||
+       header->min_node_id   != LIMIT_MIN_NODE_ID)
+        return YAUID_ERROR_STATE_LAYOUT;
+    
+    return YAUID_ERROR_STATE_CHECKSUM;
+}
+
+/* lock file must be locked by caller */
+static yauid_status_t yauid_state_read(yauid* yaobj, yauid_state *state)
+{
+    ssize_t size = pread(yaobj->i_lockfile, (void *)state, sizeof(yauid_state), 0);
+    
+    if(size == (ssize_t)sizeof(yauid_state))
+    {
+        yauid_status_t status = yauid_state_check_header(yaobj, &state->header);
+        if(status != YAUID_OK)
+            return status;
+        
+        if(state->counter.checksum != yauid_state_counter_checksum(&state->counter) ||
+           state->reserve.checksum != yauid_state_checksum(&state->reserve) ||
+           state->stats.checksum   != yauid_state_checksum(&state->stats))
+        {
+            return YAUID_ERROR_STATE_CHECKSUM;
+        }
+        
+        /* key was written by a legacy (v1) binary sharing the file; it only moves forward */
+        if(state->counter.key != state->counter.key_copy &&
+           yauid_get_timestamp(state->counter.key) < yauid_get_timestamp(state->counter.key_copy))
+        {
+            return YAUID_ERROR_STATE_CHECKSUM;
+        }
+        
+        return YAUID_OK;
+    }
+    
+    if(size == 0) {
+        yauid_state_init(yaobj, state, (hkey_t)(0));
+        return YAUID_OK;
+    }
+    
+    /* legacy format: one key without header */
+    if(size == (ssize_t)sizeof(hkey_t)) {
+        yauid_state_init(yaobj, state, *((hkey_t *)state));
+        return YAUID_OK;
+    }
+    
+    if(size < 0)
+        return YAUID_ERROR_READ_KEY;
+    
+    if((size_t)size >= offsetof(yauid_state, header) + sizeof(uint64_t) &&
+       state->header.magic == __builtin_bswap64(YAUID_STATE_MAGIC))
+        return YAUID_ERROR_STATE_ENDIAN;
+    
+    return YAUID_ERROR_STATE_FORMAT;
+}
+
+/* lock file must be locked by caller */
+static yauid_status_t yauid_state_write(yauid* yaobj, yauid_state *state)
+{
+    state->counter.key_copy = state->counter.key;
+    state->counter.checksum = yauid_state_counter_checksum(&state->counter);
+    state->reserve.checksum = yauid_state_checksum(&state->reserve);
+    state->stats.checksum   = yauid_state_checksum(&state->stats);
+    
+    if(pwrite(yaobj->i_lockfile, (const void *)state, sizeof(yauid_state), 0) != (ssize_t)sizeof(yauid_state))
+        return YAUID_ERROR_WRITE_KEY;
+    
+    return YAUID_OK;
+}
+
+/***********************************************************************************
+ *
+ * Backends
+ *
+ ***********************************************************************************/
+
+/* file: state in lock file under flock, shared by all processes of a node */
+static yauid_status_t yauid_backend_file_open(yauid* yaobj, const char *filepath_key)
+{
+    if(filepath_key == NULL)
+        return YAUID_ERROR_CREATE_KEY_FILE;
+    
+    if(access( yaobj->c_lockfile, F_OK ) == -1)
+    {
+        if((yaobj->h_lockfile = fopen(yaobj->c_lockfile, "ab")) == 0)
+            return YAUID_ERROR_CREATE_KEY_FILE;
+        
+        fclose(yaobj->h_lockfile);
+        yaobj->h_lockfile = NULL;
+    }
+    
+    if((yaobj->h_lockfile = fopen(yaobj->c_lockfile, "rb+")) == 0)
+        return YAUID_ERROR_OPEN_LOCK_FILE;
+    
+    setbuf(yaobj->h_lockfile, NULL);
+    
+    yaobj->i_lockfile = fileno(yaobj->h_lockfile);
+    
+    return YAUID_OK;
+}
+
+static void yauid_backend_file_close(yauid* yaobj)
+{
+    if(yaobj->h_lockfile)
+        fclose(yaobj->h_lockfile);
+    
+    yaobj->h_lockfile = NULL;
+}
+
+static int yauid_backend_file_unlock(yauid* yaobj)
+{
+    int result = flock(yaobj->i_lockfile, LOCK_UN);
+    
+    if(YAUID_PROBE_ENABLED(lock_release))
+        YAUID_PROBE2(lock_release, yaobj->i_lockfile, yauid_probe_time_ns() - yauid_probe_lock_ns);
+    
+    return result;
+}
+
+static yauid_status_t yauid_backend_file_lock_read(yauid* yaobj, yauid_state *state)
+{
+    uint64_t wait_ns = 0;
+    
+    if(YAUID_PROBE_ENABLED(lock_acquire) || YAUID_PROBE_ENABLED(lock_release))
+        wait_ns = yauid_probe_time_ns();
+    
+    if(flock(yaobj->i_lockfile, LOCK_EX) == -1)
+    {
+        YAUID_PROBE3(io_error, yaobj->i_lockfile, YAUID_ERROR_FILE_LOCK, errno);
+        return YAUID_ERROR_FILE_LOCK;
+    }
+    
+    if(wait_ns)
+    {
+#ifdef YAUID_WITH_USDT
+        yauid_probe_lock_ns = yauid_probe_time_ns();
+        wait_ns = yauid_probe_lock_ns - wait_ns;
+#endif
+        YAUID_PROBE2(lock_acquire, yaobj->i_lockfile, wait_ns);
+    }
+    
+    yauid_status_t status = yauid_state_read(yaobj, state);
+    
+    if(status != YAUID_OK)
+    {
+        YAUID_PROBE3(io_error, yaobj->i_lockfile, status, errno);
+        yauid_backend_file_unlock(yaobj);
+    }
+    
+    return status;
+}
+
+static yauid_status_t yauid_backend_file_reserve(yauid* yaobj, yauid_state *state)
+{
+    if(yaobj->h_lockfile == NULL)
+        return YAUID_ERROR_OPEN_LOCK_FILE;
+    
+    return yauid_backend_file_lock_read(yaobj, state);
+}
+
+static yauid_status_t yauid_backend_file_commit(yauid* yaobj, yauid_state *state, hkey_t reserved_key)
+{
+    yauid_status_t status = yauid_state_write(yaobj, state);
+    
+    if(status != YAUID_OK)
+        YAUID_PROBE3(io_error, yaobj->i_lockfile, status, errno);
+    
+    if(yauid_backend_file_unlock(yaobj) == -1 && status == YAUID_OK)
+        status = YAUID_ERROR_FILE_LOCK;
+    
+    return status;
+}
+
+static void yauid_backend_file_release(yauid* yaobj)
+{
+    yauid_backend_file_unlock(yaobj);
+}
+
+const yauid_backend yauid_backend_file = {
+    "file",
+    yauid_backend_file_open,
+    yauid_backend_file_close,
+    yauid_backend_file_reserve,
+    yauid_backend_file_commit,
+    yauid_backend_file_release
+};
+
+/* file_lazy: same lock file, opened with one open(2) on the first key */
+static yauid_status_t yauid_backend_file_lazy_open(yauid* yaobj, const char *filepath_key)
+{
+    if(filepath_key == NULL)
+        return YAUID_ERROR_CREATE_KEY_FILE;
+    
+    yaobj->i_lockfile = -1;
+    
+    return YAUID_OK;
+}
+
+static void yauid_backend_file_lazy_close(yauid* yaobj)
+{
+    if(yaobj->i_lockfile >= 0)
+        close(yaobj->i_lockfile);
+    
+    yaobj->i_lockfile = -1;
+}
+
+static yauid_status_t yauid_backend_file_lazy_reserve(yauid* yaobj, yauid_state *state)
+{
+    if(__atomic_load_n(&yaobj->i_lockfile, __ATOMIC_ACQUIRE) < 0)
+    {
+        int fd = open(yaobj->c_lockfile, O_RDWR|O_CREAT|O_CLOEXEC, 0666);
+        
+        if(fd == -1) {
+            YAUID_PROBE3(io_error, fd, YAUID_ERROR_OPEN_LOCK_FILE, errno);
+            return YAUID_ERROR_OPEN_LOCK_FILE;
+        }
+        
+        /* other thread of this handle opened it first */
+        int expected = -1;
+        if(__atomic_compare_exchange_n(&yaobj->i_lockfile, &expected, fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) == 0)
+            close(fd);
+    }
+    
+    return yauid_backend_file_lock_read(yaobj, state);
+}
+
+const yauid_backend yauid_backend_file_lazy = {
+    "file_lazy",
+    yauid_backend_file_lazy_open,
+    yauid_backend_file_lazy_close,
+    yauid_backend_file_lazy_reserve,
+    yauid_backend_file_commit,
+    yauid_backend_file_release
+};
+
+/* memory: last key in a process-wide atomic; no files, no coordination between processes */
+static hkey_t yauid_backend_memory_key = (hkey_t)(0);
+static int    yauid_backend_memory_ready = 0;
+
+/*
+ * Counter starts from zero in every process: a previous process with the same node id
+ * may have issued keys in the current second. Keys are issued from the next second on
+ */
+static void yauid_backend_memory_wait_start(void)
+{
+    if(__atomic_load_n(&yauid_backend_memory_ready, __ATOMIC_ACQUIRE))
+        return;
+    
+    time_t start = time(NULL);
+    
+    while(time(NULL) <= start)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        
+        ts.tv_sec  = 0;
+        ts.tv_nsec = 1000000000L - ts.tv_nsec;
+        
+        nanosleep(&ts, NULL);
+    }
+    
+    __atomic_store_n(&yauid_backend_memory_ready, 1, __ATOMIC_RELEASE);
+}
+
+static yauid_status_t yauid_backend_memory_open(yauid* yaobj, const char *filepath_key)
+{
+    return YAUID_OK;
+}
+
+static void yauid_backend_memory_close(yauid* yaobj)
+{
+}
+
+static yauid_status_t yauid_backend_memory_reserve(yauid* yaobj, yauid_state *state)
+{
+    yauid_backend_memory_wait_start();
+    
+    yauid_state_init(yaobj, state, __atomic_load_n(&yauid_backend_memory_key, __ATOMIC_ACQUIRE));
+    return YAUID_OK;
+}
+
+static yauid_status_t yauid_backend_memory_commit(yauid* yaobj, yauid_state *state, hkey_t reserved_key)
+{
+    if(__atomic_compare_exchange_n(&yauid_backend_memory_key, &reserved_key, state->counter.key, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return YAUID_OK;
+    
+    return YAUID_ERROR_STATE_CHANGED;
+}
+
+static void yauid_backend_memory_release(yauid* yaobj)
+{
+}
+
+const yauid_backend yauid_backend_memory = {
+    "memory",
+    yauid_backend_memory_open,
+    yauid_backend_memory_close,
+    yauid_backend_memory_reserve,
+    yauid_backend_memory_commit,
+    yauid_backend_memory_release
+};
+
+yauid_status_t yauid_get_state(yauid* yaobj, yauid_state *state)
+{
+    yauid_status_t status = yaobj->backend->reserve(yaobj, state);
+    
+    if(status == YAUID_OK)
+        yaobj->backend->release(yaobj);
+    
+    return status;
+}
+
 unsigned long yauid_get_inc_id(hkey_t key)
 {
     key <<= (BIT_LIMIT_TIMESTAMP + BIT_LIMIT_NODE);
@@ -82,165 +514,271 @@ unsigned long long int yauid_get_max_timestamp()
     return NUMBER_LIMIT_TIMESTAMP;
 }
 
-hkey_t yauid_get_key(yauid* yaobj)
+/* reserve up to count consecutive keys of the current second; returns first key */
+static hkey_t yauid_reserve_keys(yauid* yaobj, size_t count, size_t *reserved, yauid_status_t *status)
 {
-    hkey_t key = (hkey_t)(0);
-    unsigned int count = 0;
+    hkey_t key = (hkey_t)(0), tmp = (hkey_t)(1), ltime = (hkey_t)(0), last = (hkey_t)(0);
+    yauid_state state;
+    
+    *reserved = 0;
+    
+    if(yaobj->node_id < LIMIT_MIN_NODE_ID)
+    {
+        *status = YAUID_ERROR_SHORT_NODE_ID;
+        return key;
+    }
+    else if(yaobj->node_id > NUMBER_LIMIT_NODE)
+    {
+        *status = YAUID_ERROR_LONG_NODE_ID;
+        return key;
+    }
     
     for(;;)
     {
-        if((key = yauid_get_key_once(yaobj)) == (hkey_t)(0))
+        *status = yaobj->backend->reserve(yaobj, &state);
+        
+        if(*status != YAUID_OK)
+            return (hkey_t)(0);
+        
+        key = last = state.counter.key;
+        ltime = time(NULL);
+        tmp = (hkey_t)(1);
+        
+        YAUID_PROBE1(clock_read, ltime);
+        
+        if(key)
         {
-            if(yaobj->error == YAUID_ERROR_KEYS_ENDED)
+            tmp = key >> (BIT_LIMIT_NODE + BIT_LIMIT_INC);
+            key <<= (BIT_LIMIT_TIMESTAMP + BIT_LIMIT_NODE);
+            key >>= (BIT_LIMIT - BIT_LIMIT_INC);
+            
+            key++;
+            
+            if(tmp == ltime)
             {
-                count++;
-                
-                if(yaobj->try_count && count >= yaobj->try_count)
+                if(key > (hkey_t)(NUMBER_LIMIT))
                 {
-                    yaobj->error = YAUID_ERROR_TRY_COUNT_KEY;
-                    break;
+                    yaobj->backend->release(yaobj);
+                    
+                    YAUID_PROBE2(keys_ended, last, ltime);
+                    
+                    *status = YAUID_ERROR_KEYS_ENDED;
+                    return (hkey_t)(0);
                 }
                 
-                usleep(yaobj->sleep_usec);
-                continue;
+                tmp = key;
             }
+            else
+                tmp = (hkey_t)(1);
         }
         
+        if(count > (size_t)(NUMBER_LIMIT - tmp + 1))
+            count = (size_t)(NUMBER_LIMIT - tmp + 1);
+        
+        key = ltime;
+        key <<= BIT_LIMIT_NODE;
+        
+        key |= yaobj->node_id;
+        key <<= BIT_LIMIT_INC;
+        
+        key |= tmp;
+        
+        if(tmp == (hkey_t)(1))
+            state.stats.seconds++;
+        if(state.stats.first == 0)
+            state.stats.first = ltime;
+        
+        state.stats.last = ltime;
+        state.stats.keys += count;
+        state.counter.key = key + (hkey_t)(count - 1);
+        
+        if(count > 1) {
+            state.reserve.key   = state.counter.key;
+            state.reserve.count = count;
+        }
+        
+        *status = yaobj->backend->commit(yaobj, &state, last);
+        
+        /* other thread committed first: take the new state */
+        if(*status == YAUID_ERROR_STATE_CHANGED)
+            continue;
+        
+        if(*status != YAUID_OK)
+            return (hkey_t)(0);
+        
         break;
     }
     
+    *reserved = count;
+    
+    YAUID_PROBE2(key_issue, key, count);
+    
     return key;
 }
 
-hkey_t yauid_get_key_once(yauid* yaobj)
+/* in durable mode keys are returned only after they are synced to disk */
+static hkey_t yauid_issue_keys(yauid* yaobj, size_t count, size_t *reserved, yauid_status_t *status)
 {
-    hkey_t key = (hkey_t)(0), tmp = (hkey_t)(1), ltime = (hkey_t)(0);
+    if(yaobj->durable == NULL)
+        return yauid_reserve_keys(yaobj, count, reserved, status);
     
-    if(yaobj->node_id < LIMIT_MIN_NODE_ID)
-    {
-        yaobj->error = YAUID_ERROR_SHORT_NODE_ID;
-        return key;
-    }
-    else if(yaobj->node_id > NUMBER_LIMIT_NODE)
-    {
-        yaobj->error = YAUID_ERROR_LONG_NODE_ID;
-        return key;
-    }
+    uint64_t seq = 0;
     
-    yaobj->error = YAUID_OK;
+    yauid_durable_lock(yaobj->durable);
     
-    if(flock(yaobj->i_lockfile, LOCK_EX) == -1)
-    {
-        yaobj->error = YAUID_ERROR_FILE_LOCK;
-        return (hkey_t)(0);
-    }
+    hkey_t key = yauid_reserve_keys(yaobj, count, reserved, status);
+    if(key)
+        seq = yauid_durable_written(yaobj->durable);
+    
+    yauid_durable_unlock(yaobj->durable);
     
-    if(fseek(yaobj->h_lockfile, 0, SEEK_SET) != 0)
+    if(key && yauid_durable_wait(yaobj->durable, seq) != YAUID_OK)
     {
-        flock(yaobj->i_lockfile, LOCK_UN);
+        *status = YAUID_ERROR_SYNC_KEY;
+        *reserved = 0;
         
-        yaobj->error = YAUID_ERROR_FILE_SEEK;
         return (hkey_t)(0);
     }
     
-    if(fread((void *)(&key), sizeof(hkey_t), 1, yaobj->h_lockfile) != 1)
+    return key;
+}
+
+/*
+ * Status of a call is kept in a local: with prefetch or durable mode the handle is shared
+ * by threads, and yaobj->error is only stored once at the end of a public call
+ */
+static hkey_t yauid_take_key(yauid* yaobj, yauid_status_t *status)
+{
+    size_t reserved;
+    
+    if(yaobj->prefetch)
     {
-        if(fseek(yaobj->h_lockfile, 0L, SEEK_END) != 0)
-        {
-            flock(yaobj->i_lockfile, LOCK_UN);
-            
-            yaobj->error = YAUID_ERROR_FILE_SEEK;
-            return (hkey_t)(0);
-        }
+        hkey_t key = yauid_prefetch_pop(yaobj->prefetch);
         
-        long h_size = ftell(yaobj->h_lockfile);
-        if(h_size > 0)
-        {
-            flock(yaobj->i_lockfile, LOCK_UN);
-            
-            yaobj->error = YAUID_ERROR_READ_KEY;
-            return (hkey_t)(0);
+        if(key) {
+            *status = YAUID_OK;
+            return key;
         }
         
-        if(fseek(yaobj->h_lockfile, 0, SEEK_SET) != 0)
-        {
-            flock(yaobj->i_lockfile, LOCK_UN);
-            
-            yaobj->error = YAUID_ERROR_FILE_SEEK;
-            return (hkey_t)(0);
-        }
+        /* ring is shared by threads, lock file descriptor is not */
+        yauid_prefetch_lock(yaobj->prefetch);
+        key = yauid_issue_keys(yaobj, 1, &reserved, status);
+        yauid_prefetch_unlock(yaobj->prefetch);
+        
+        return key;
     }
     
-    ltime = time(NULL);
+    return yauid_issue_keys(yaobj, 1, &reserved, status);
+}
+
+static void yauid_set_error(yauid* yaobj, yauid_status_t status)
+{
+    __atomic_store_n(&yaobj->error, status, __ATOMIC_RELAXED);
+}
+
+hkey_t yauid_get_key_once(yauid* yaobj)
+{
+    yauid_status_t status = YAUID_OK;
+    hkey_t key = yauid_take_key(yaobj, &status);
     
-    if(key)
+    yauid_set_error(yaobj, status);
+    
+    return key;
+}
+
+hkey_t yauid_get_key(yauid* yaobj)
+{
+    hkey_t key = (hkey_t)(0);
+    unsigned int count = 0;
+    yauid_status_t status = YAUID_OK;
+    
+    for(;;)
     {
-        tmp = key >> (BIT_LIMIT_NODE + BIT_LIMIT_INC);
-        key <<= (BIT_LIMIT_TIMESTAMP + BIT_LIMIT_NODE);
-        key >>= (BIT_LIMIT - BIT_LIMIT_INC);
-        
-        key++;
-        
-        if(tmp == ltime)
+        if((key = yauid_take_key(yaobj, &status)) == (hkey_t)(0))
         {
-            if(key > (hkey_t)(NUMBER_LIMIT))
+            if(status == YAUID_ERROR_KEYS_ENDED)
             {
-                flock(yaobj->i_lockfile, LOCK_UN);
+                count++;
                 
-                yaobj->error = YAUID_ERROR_KEYS_ENDED;
-                return (hkey_t)(0);
+                if(yaobj->try_count && count >= yaobj->try_count)
+                {
+                    status = YAUID_ERROR_TRY_COUNT_KEY;
+                    break;
+                }
+                
+                YAUID_PROBE2(retry_sleep, count, yaobj->sleep_usec);
+                usleep(yaobj->sleep_usec);
+                continue;
             }
-            
-            tmp = key;
         }
-        else
-            tmp = (hkey_t)(1);
+        
+        break;
     }
     
-    key = ltime;
-    key <<= BIT_LIMIT_NODE;
+    yauid_set_error(yaobj, status);
     
-    key |= yaobj->node_id;
-    key <<= BIT_LIMIT_INC;
+    return key;
+}
+
+size_t yauid_get_keys_once(yauid* yaobj, hkey_t *keys, size_t count)
+{
+    size_t i, reserved;
+    yauid_status_t status = YAUID_OK;
     
-    key |= tmp;
+    if(count == 0)
+        return 0;
     
-    if(fseek(yaobj->h_lockfile, 0, SEEK_SET) != 0)
-    {
-        flock(yaobj->i_lockfile, LOCK_UN);
-        
-        yaobj->error = YAUID_ERROR_FILE_SEEK;
-        return (hkey_t)(0);
-    }
+    hkey_t key = yauid_issue_keys(yaobj, count, &reserved, &status);
     
-    if(fwrite((const void *)(&key), sizeof(hkey_t), 1, yaobj->h_lockfile) != 1)
-    {
-        flock(yaobj->i_lockfile, LOCK_UN);
-        
-        yaobj->error = YAUID_ERROR_WRITE_KEY;
-        return (hkey_t)(0);
-    }
+    for(i = 0; i < reserved; i++)
+        keys[i] = key + (hkey_t)(i);
+    
+    yauid_set_error(yaobj, status);
     
-    if(fflush(yaobj->h_lockfile) != 0)
+    return reserved;
+}
+
+/* one read into a stack buffer; all digits of the file make the node id */
+static yauid_status_t yauid_read_node_id(const char *filepath_node_id, unsigned long *node_id)
+{
+    char text[128];
+    ssize_t size, i, total = 0;
+    
+    *node_id = 0;
+    
+    int fd = open(filepath_node_id, O_RDONLY|O_CLOEXEC);
+    if(fd == -1)
+        return (errno == ENOENT) ? YAUID_ERROR_FILE_NODE_EXT : YAUID_OK;
+    
+    while((size = read(fd, text, sizeof(text))) > 0)
     {
-        flock(yaobj->i_lockfile, LOCK_UN);
+        for(i = 0; i < size; i++)
+        {
+            if(text[i] >= '0' && text[i] <= '9' && *node_id <= NUMBER_LIMIT_NODE)
+                *node_id = (text[i] - '0') + (*node_id * 10);
+        }
         
-        yaobj->error = YAUID_ERROR_FLUSH_KEY;
-        return (hkey_t)(0);
+        total += size;
+        
+        /* short read of a regular file is its end */
+        if(size < (ssize_t)sizeof(text))
+            break;
     }
     
-    if(flock(yaobj->i_lockfile, LOCK_UN) == -1)
-    {
-        yaobj->error = YAUID_ERROR_FILE_LOCK;
-        return (hkey_t)(0);
-    }
+    close(fd);
     
-    yaobj->error = YAUID_OK;
+    if(size < 0 || total == 0)
+        return YAUID_ERROR_FILE_NODE_ID;
     
-    return key;
+    if(*node_id < LIMIT_MIN_NODE_ID)
+        return YAUID_ERROR_SHORT_NODE_ID;
+    else if(*node_id > NUMBER_LIMIT_NODE)
+        return YAUID_ERROR_LONG_NODE_ID;
+    
+    return YAUID_OK;
 }
 
-yauid * yauid_init(const char *filepath_key, const char *filepath_node_id)
+static yauid * yauid_create(const yauid_backend *backend, const char *filepath_key)
 {
     yauid* yaobj = (yauid *)malloc(sizeof(yauid));
     
@@ -248,114 +786,183 @@ yauid * yauid_init(const char *filepath_key, const char *filepath_node_id)
     {
         yaobj->node_id    = 0;
         yaobj->error      = YAUID_OK;
-        yaobj->i_lockfile = 0;
+        yaobj->i_lockfile = -1;
         yaobj->h_lockfile = NULL;
         yaobj->try_count  = 0;
         yaobj->sleep_usec = (useconds_t)(35000L);
         yaobj->ext_value  = 0;
+        yaobj->c_lockfile = NULL;
+        yaobj->prefetch   = NULL;
+        yaobj->durable    = NULL;
         
-        if(filepath_key == NULL)
+        yaobj->backend      = backend;
+        yaobj->backend_data = NULL;
+        
+        yauid_state_header_init(&yaobj->state_header);
+        
+        if(filepath_key)
         {
-            yaobj->error = YAUID_ERROR_CREATE_KEY_FILE;
-            return yaobj;
+            yaobj->c_lockfile = strdup(filepath_key);
+            if(yaobj->c_lockfile == NULL)
+                yaobj->error = YAUID_ERROR_ALLOC_KEY_FILE;
         }
+    }
+    
+    return yaobj;
+}
+
+yauid * yauid_init(const char *filepath_key, const char *filepath_node_id)
+{
+    return yauid_init_backend(&yauid_backend_file, filepath_key, filepath_node_id);
+}
+
+yauid * yauid_init_backend(const yauid_backend *backend, const char *filepath_key, const char *filepath_node_id)
+{
+    yauid* yaobj = yauid_create(backend, filepath_key);
+    
+    if(yaobj == NULL || yaobj->error != YAUID_OK)
+        return yaobj;
+    
+    if(filepath_node_id != NULL)
+    {
+        yaobj->error = yauid_read_node_id(filepath_node_id, &yaobj->node_id);
         
-        yaobj->c_lockfile = strdup(filepath_key);
-        if(yaobj->c_lockfile == NULL)
-        {
-            yaobj->error = YAUID_ERROR_ALLOC_KEY_FILE;
+        if(yaobj->error != YAUID_OK)
             return yaobj;
-        }
+    }
+    
+    yaobj->error = backend->open(yaobj, filepath_key);
+    
+    return yaobj;
+}
+
+/* node id cache of yauid_init_lazy: process-wide, then YAUID_NODE_ID_ENV */
+static pthread_mutex_t yauid_node_id_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *yauid_node_id_path = NULL;
+static unsigned long yauid_node_id_cached = 0;
+
+/* "<node id>:<file path>"; 0 if not set, invalid or of other file */
+static unsigned long yauid_node_id_from_env(const char *filepath_node_id)
+{
+    const char *env = getenv(YAUID_NODE_ID_ENV), *pos;
+    unsigned long node_id = 0;
+    
+    if(env == NULL)
+        return 0;
+    
+    for(pos = env; *pos >= '0' && *pos <= '9'; pos++)
+    {
+        node_id = (*pos - '0') + (node_id * 10);
         
-        if(filepath_node_id != NULL)
-        {
-            if(access( filepath_node_id, F_OK ) != -1)
-            {
-                FILE* h_node_id;
-                if((h_node_id = fopen(filepath_node_id, "rb")))
-                {
-                    fseek(h_node_id, 0L, SEEK_END);
-                    
-                    long h_size = ftell(h_node_id);
-                    if(h_size <= 0)
-                    {
-                        fclose(h_node_id);
-                        yaobj->error = YAUID_ERROR_FILE_NODE_ID;
-                        return yaobj;
-                    }
-                    
-                    fseek(h_node_id, 0L, SEEK_SET);
-                    
-                    char *text = (char *)malloc(sizeof(char) * (h_size + 1));
-                    if(text == NULL)
-                    {
-                        fclose(h_node_id);
-                        yaobj->error = YAUID_ERROR_FILE_NODE_MEM;
-                        return yaobj;
-                    }
-                    
-                    fread(text, sizeof(char), h_size, h_node_id);
-                    fclose(h_node_id);
-                    
-                    long i = 0;
-                    for(i = 0; i < h_size; i++)
-                    {
-                        if(text[i] >= '0' && text[i] <= '9')
-                            yaobj->node_id = (text[i] - '0') + (yaobj->node_id * 10);
-                    }
-                    
-                    free(text);
-                    
-                    if(yaobj->node_id < LIMIT_MIN_NODE_ID)
-                    {
-                        yaobj->error = YAUID_ERROR_SHORT_NODE_ID;
-                        return yaobj;
-                    }
-                    else if(yaobj->node_id > NUMBER_LIMIT_NODE)
-                    {
-                        yaobj->error = YAUID_ERROR_LONG_NODE_ID;
-                        return yaobj;
-                    }
-                }
-            }
-            else {
-                yaobj->error = YAUID_ERROR_FILE_NODE_EXT;
-                return yaobj;
-            }
-        }
+        if(node_id > NUMBER_LIMIT_NODE)
+            return 0;
+    }
+    
+    if(pos == env || *pos != ':' || strcmp(pos + 1, filepath_node_id) != 0 || node_id < LIMIT_MIN_NODE_ID)
+        return 0;
+    
+    return node_id;
+}
+
+static unsigned long yauid_node_id_cache_get(const char *filepath_node_id)
+{
+    unsigned long node_id = 0;
+    
+    pthread_mutex_lock(&yauid_node_id_mutex);
+    
+    if(yauid_node_id_path && strcmp(yauid_node_id_path, filepath_node_id) == 0)
+        node_id = yauid_node_id_cached;
+    
+    pthread_mutex_unlock(&yauid_node_id_mutex);
+    
+    if(node_id == 0)
+        node_id = yauid_node_id_from_env(filepath_node_id);
+    
+    return node_id;
+}
+
+static void yauid_node_id_cache_set(const char *filepath_node_id, unsigned long node_id)
+{
+    char *path = strdup(filepath_node_id);
+    
+    if(path == NULL)
+        return;
+    
+    pthread_mutex_lock(&yauid_node_id_mutex);
+    
+    free(yauid_node_id_path);
+    
+    yauid_node_id_path   = path;
+    yauid_node_id_cached = node_id;
+    
+    pthread_mutex_unlock(&yauid_node_id_mutex);
+}
+
+yauid * yauid_init_lazy(const char *filepath_key, const char *filepath_node_id)
+{
+    yauid* yaobj = yauid_create(&yauid_backend_file_lazy, filepath_key);
+    
+    if(yaobj == NULL || yaobj->error != YAUID_OK)
+        return yaobj;
+    
+    if(filepath_node_id != NULL)
+    {
+        yaobj->node_id = yauid_node_id_cache_get(filepath_node_id);
         
-        if(access( yaobj->c_lockfile, F_OK ) == -1)
+        if(yaobj->node_id == 0)
         {
-            if((yaobj->h_lockfile = fopen(yaobj->c_lockfile, "ab")) == 0)
-            {
-                yaobj->error = YAUID_ERROR_CREATE_KEY_FILE;
+            yaobj->error = yauid_read_node_id(filepath_node_id, &yaobj->node_id);
+            
+            if(yaobj->error != YAUID_OK)
+                return yaobj;
+            
+            /* file exists but can't be opened */
+            if(yaobj->node_id < LIMIT_MIN_NODE_ID) {
+                yaobj->error = YAUID_ERROR_FILE_NODE_ID;
                 return yaobj;
             }
             
-            fclose(yaobj->h_lockfile);
-        }
-        
-        if((yaobj->h_lockfile = fopen(yaobj->c_lockfile, "rb+")) == 0)
-        {
-            yaobj->error = YAUID_ERROR_OPEN_LOCK_FILE;
-            return yaobj;
+            yauid_node_id_cache_set(filepath_node_id, yaobj->node_id);
         }
-        
-        setbuf(yaobj->h_lockfile, NULL);
-        
-        yaobj->i_lockfile = fileno(yaobj->h_lockfile);
     }
     
+    yaobj->error = yauid_backend_file_lazy.open(yaobj, filepath_key);
+    
     return yaobj;
 }
 
+yauid_status_t yauid_export_node_id(yauid* yaobj, const char *filepath_node_id)
+{
+    if(yaobj->node_id < LIMIT_MIN_NODE_ID)
+        return YAUID_ERROR_SHORT_NODE_ID;
+    else if(yaobj->node_id > NUMBER_LIMIT_NODE)
+        return YAUID_ERROR_LONG_NODE_ID;
+    
+    size_t len = strlen(filepath_node_id) + 24;
+    
+    char *text = (char *)malloc(sizeof(char) * len);
+    if(text == NULL)
+        return YAUID_ERROR_FILE_NODE_MEM;
+    
+    snprintf(text, len, "%lu:%s", yaobj->node_id, filepath_node_id);
+    
+    int result = setenv(YAUID_NODE_ID_ENV, text, 1);
+    
+    free(text);
+    
+    return (result == 0) ? YAUID_OK : YAUID_ERROR_FILE_NODE_MEM;
+}
+
 void yauid_destroy(yauid* yaobj)
 {
     if(yaobj == NULL)
         return;
     
-    if(yaobj->h_lockfile)
-        fclose(yaobj->h_lockfile);
+    yauid_prefetch_stop(yaobj);
+    yauid_set_durable(yaobj, 0, 0);
+    
+    yaobj->backend->close(yaobj);
+    
     if(yaobj->c_lockfile)
         free(yaobj->c_lockfile);
     
@@ -364,7 +971,7 @@ void yauid_destroy(yauid* yaobj)
 
 char * yauid_get_error_text_by_code(yauid_status_t error)
 {
-    if((YAUID_ERROR_CREATE_OBJECT - YAUID_OK) < error)
+    if(error < YAUID_OK || (size_t)error >= (sizeof(error_text) / sizeof(error_text[0])))
         return NULL;
     
     return error_text[error];
@@ -486,7 +1093,7 @@ void yauid_get_period_key_by_timestamp(time_t from_timestamp,
 
 yauid_status_t yauid_get_error_code(yauid* yaobj)
 {
-    return yaobj->error;
+    return __atomic_load_n(&yaobj->error, __ATOMIC_RELAXED);
 };
 
 #endif
@@ -0,0 +1,308 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <yauid_backfill.h>
+#include <pthread.h>
+
+static yauid_status_t yauid_backfill_check_node_id(unsigned long node_id)
+{
+    if(node_id < LIMIT_MIN_NODE_ID)
+        return YAUID_ERROR_SHORT_NODE_ID;
+    else if(node_id > NUMBER_LIMIT_NODE)
+        return YAUID_ERROR_LONG_NODE_ID;
+    
+    return YAUID_OK;
+}
+
+yauid_backfill * yauid_backfill_create(unsigned long node_id, time_t from, time_t to)
+{
+    yauid_backfill* backfill = (yauid_backfill *)calloc(1, sizeof(yauid_backfill));
+    if(backfill == NULL)
+        return NULL;
+    
+    backfill->node_id = node_id;
+    backfill->policy  = YAUID_BACKFILL_REFUSE;
+    backfill->error   = yauid_backfill_check_node_id(node_id);
+    
+    if(backfill->error != YAUID_OK)
+        return backfill;
+    
+    if(from <= 0 || to < from || (unsigned long long int)to > NUMBER_LIMIT_TIMESTAMP) {
+        backfill->error = YAUID_ERROR_BACKFILL_RANGE;
+        return backfill;
+    }
+    
+    backfill->from = (uint64_t)from;
+    backfill->to   = (uint64_t)to;
+    
+    /* all seconds are refused until live seconds are set with yauid_backfill_set_live* */
+    backfill->live_from = backfill->from;
+    
+    backfill->counters = (uint32_t *)calloc((size_t)(to - from + 1), sizeof(uint32_t));
+    if(backfill->counters == NULL) {
+        free(backfill);
+        return NULL;
+    }
+    
+    return backfill;
+}
+
+void yauid_backfill_destroy(yauid_backfill* backfill)
+{
+    if(backfill == NULL)
+        return;
+    
+    free(backfill->counters);
+    free(backfill->remap_counters);
+    free(backfill);
+}
+
+yauid_status_t yauid_backfill_set_live_from(yauid_backfill* backfill, time_t live_from,
+                                            yauid_backfill_policy policy, unsigned long backfill_node_id)
+{
+    if(backfill->error != YAUID_OK)
+        return backfill->error;
+    
+    if(policy == YAUID_BACKFILL_REMAP)
+    {
+        yauid_status_t status = yauid_backfill_check_node_id(backfill_node_id);
+        
+        if(status != YAUID_OK)
+            return status;
+        
+        if(backfill_node_id == backfill->node_id)
+            return YAUID_ERROR_BACKFILL_NODE_ID;
+        
+        if(backfill->remap_counters == NULL) {
+            backfill->remap_counters = (uint32_t *)calloc((size_t)(backfill->to - backfill->from + 1), sizeof(uint32_t));
+            
+            if(backfill->remap_counters == NULL)
+                return YAUID_ERROR_CREATE_OBJECT;
+        }
+    }
+    
+    backfill->live_from        = (live_from > 0) ? (uint64_t)live_from : 0;
+    backfill->policy           = policy;
+    backfill->backfill_node_id = backfill_node_id;
+    
+    return YAUID_OK;
+}
+
+yauid_status_t yauid_backfill_set_live(yauid_backfill* backfill, yauid* yaobj,
+                                       yauid_backfill_policy policy, unsigned long backfill_node_id)
+{
+    yauid_state state;
+    yauid_status_t status = yauid_get_state(yaobj, &state);
+    
+    if(status != YAUID_OK)
+        return status;
+    
+    /* nothing issued from this lock file */
+    if(state.counter.key == (hkey_t)(0))
+        return yauid_backfill_set_live_from(backfill, 0, policy, backfill_node_id);
+    
+    /* lock file of other node: no conflict */
+    if(yauid_get_node_id(state.counter.key) != backfill->node_id)
+        return yauid_backfill_set_live_from(backfill, 0, policy, backfill_node_id);
+    
+    /* keys before stats.first are not recorded */
+    if((state.stats.flags & YAUID_STATE_STATS_PARTIAL) || state.stats.first == 0)
+        return YAUID_ERROR_BACKFILL_HISTORY;
+    
+    return yauid_backfill_set_live_from(backfill, (time_t)state.stats.first, policy, backfill_node_id);
+}
+
+size_t yauid_backfill_get_keys(yauid_backfill* backfill, const time_t *timestamps, size_t count, hkey_t *keys)
+{
+    size_t i = 0, j, issued = 0;
+    uint64_t remapped = 0, refused = 0, exhausted = 0;
+    
+    while(i < count)
+    {
+        time_t timestamp = timestamps[i];
+        size_t run = 1;
+        
+        while(i + run < count && timestamps[i + run] == timestamp)
+            run++;
+        
+        uint32_t *counters = backfill->counters;
+        unsigned long node_id = backfill->node_id;
+        
+        if(timestamp <= 0 || (uint64_t)timestamp < backfill->from || (uint64_t)timestamp > backfill->to) {
+            counters = NULL;
+        }
+        else if(backfill->live_from && (uint64_t)timestamp >= backfill->live_from) {
+            if(backfill->policy == YAUID_BACKFILL_REMAP) {
+                counters = backfill->remap_counters;
+                node_id  = backfill->backfill_node_id;
+                remapped += run;
+            }
+            else
+                counters = NULL;
+        }
+        
+        if(counters == NULL) {
+            for(j = 0; j < run; j++)
+                keys[i + j] = (hkey_t)(0);
+            
+            refused += run;
+            i += run;
+            
+            continue;
+        }
+        
+        /* one atomic update per run of equal timestamps; counter saturates at NUMBER_LIMIT */
+        uint32_t *counter = &counters[(uint64_t)timestamp - backfill->from];
+        uint32_t inc = __atomic_load_n(counter, __ATOMIC_RELAXED), next;
+        
+        do {
+            next = (run < (size_t)(NUMBER_LIMIT - inc)) ? inc + (uint32_t)run : (uint32_t)NUMBER_LIMIT;
+        }
+        while(inc < (uint32_t)NUMBER_LIMIT &&
+              __atomic_compare_exchange_n(counter, &inc, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) == 0);
+        
+        hkey_t key = ((hkey_t)(timestamp) << (BIT_LIMIT_NODE + BIT_LIMIT_INC)) | ((hkey_t)(node_id) << BIT_LIMIT_INC);
+        
+        for(j = 0; j < run; j++)
+        {
+            if(inc == (uint32_t)NUMBER_LIMIT) {
+                keys[i + j] = (hkey_t)(0);
+                exhausted++;
+            }
+            else {
+                keys[i + j] = key | (hkey_t)(++inc);
+                issued++;
+            }
+        }
+        
+        i += run;
+    }
+    
+    __atomic_fetch_add(&backfill->issued, (uint64_t)issued, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&backfill->remapped, remapped, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&backfill->refused, refused, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&backfill->exhausted, exhausted, __ATOMIC_RELAXED);
+    
+    return issued;
+}
+
+static void yauid_backfill_seed_counter(uint32_t *counter, uint32_t inc)
+{
+    uint32_t cur = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    
+    while(cur < inc &&
+          __atomic_compare_exchange_n(counter, &cur, inc, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) == 0)
+    {}
+}
+
+size_t yauid_backfill_seed(yauid_backfill* backfill, const hkey_t *keys, size_t count)
+{
+    size_t i, seeded = 0;
+    
+    if(backfill->error != YAUID_OK)
+        return 0;
+    
+    for(i = 0; i < count; i++)
+    {
+        uint64_t timestamp = keys[i] >> (BIT_LIMIT_NODE + BIT_LIMIT_INC);
+        unsigned long node_id = (unsigned long)((keys[i] >> BIT_LIMIT_INC) & NUMBER_LIMIT_NODE);
+        uint32_t inc = (uint32_t)(keys[i] & NUMBER_LIMIT);
+        
+        if(timestamp < backfill->from || timestamp > backfill->to)
+            continue;
+        
+        if(node_id == backfill->node_id) {
+            yauid_backfill_seed_counter(&backfill->counters[timestamp - backfill->from], inc);
+            seeded++;
+        }
+        else if(backfill->remap_counters && node_id == backfill->backfill_node_id) {
+            yauid_backfill_seed_counter(&backfill->remap_counters[timestamp - backfill->from], inc);
+            seeded++;
+        }
+    }
+    
+    return seeded;
+}
+
+struct yauid_backfill_part {
+    yauid_backfill* backfill;
+    const time_t *timestamps;
+    size_t count;
+    hkey_t *keys;
+    size_t issued;
+    int started;
+}
+typedef yauid_backfill_part;
+
+static void * yauid_backfill_thread(void *arg)
+{
+    yauid_backfill_part *part = (yauid_backfill_part *)arg;
+    part->issued = yauid_backfill_get_keys(part->backfill, part->timestamps, part->count, part->keys);
+    
+    return NULL;
+}
+
+size_t yauid_backfill_run(yauid_backfill* backfill, const time_t *timestamps, size_t count,
+                          hkey_t *keys, unsigned int threads)
+{
+    if(threads <= 1 || count < threads)
+        return yauid_backfill_get_keys(backfill, timestamps, count, keys);
+    
+    yauid_backfill_part *parts = (yauid_backfill_part *)calloc(threads, sizeof(yauid_backfill_part));
+    pthread_t *ids = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+    
+    if(parts == NULL || ids == NULL) {
+        free(parts);
+        free(ids);
+        
+        return yauid_backfill_get_keys(backfill, timestamps, count, keys);
+    }
+    
+    size_t i, issued = 0, offset = 0, step = count / threads;
+    
+    for(i = 0; i < threads; i++)
+    {
+        parts[i].backfill   = backfill;
+        parts[i].timestamps = &timestamps[offset];
+        parts[i].keys       = &keys[offset];
+        parts[i].count      = (i + 1 == threads) ? (count - offset) : step;
+        
+        offset += parts[i].count;
+    }
+    
+    for(i = 1; i < threads; i++) {
+        if(pthread_create(&ids[i], NULL, yauid_backfill_thread, &parts[i]) == 0)
+            parts[i].started = 1;
+        else
+            yauid_backfill_thread(&parts[i]);
+    }
+    
+    yauid_backfill_thread(&parts[0]);
+    
+    for(i = 0; i < threads; i++)
+    {
+        if(parts[i].started)
+            pthread_join(ids[i], NULL);
+        
+        issued += parts[i].issued;
+    }
+    
+    free(parts);
+    free(ids);
+    
+    return issued;
+}
+
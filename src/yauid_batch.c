@@ -0,0 +1,335 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <yauid_batch.h>
+
+#if defined(__SSE2__) && defined(__x86_64__)
+#define YAUID_BATCH_SSE2
+#include <emmintrin.h>
+#endif
+
+/* explicit AVX2 path of yauid_validate_batch, selected at run time */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define YAUID_BATCH_AVX2
+#include <immintrin.h>
+#endif
+
+void yauid_decode_keys(const hkey_t *keys, size_t count,
+                       unsigned long *timestamps, unsigned long *node_ids, unsigned long *incs)
+{
+    size_t i = 0;
+    
+#ifdef YAUID_BATCH_SSE2
+    /* 2 keys per 128 bit register; SSE2 is part of every x86-64 CPU */
+    const __m128i node_mask = _mm_set1_epi64x(NUMBER_LIMIT_NODE);
+    const __m128i inc_mask  = _mm_set1_epi64x(NUMBER_LIMIT);
+    
+    if(timestamps) {
+        for(i = 0; i + 2 <= count; i += 2) {
+            __m128i key = _mm_loadu_si128((const __m128i *)&keys[i]);
+            _mm_storeu_si128((__m128i *)&timestamps[i], _mm_srli_epi64(key, BIT_LIMIT_NODE + BIT_LIMIT_INC));
+        }
+        
+        for(; i < count; i++)
+            timestamps[i] = (unsigned long)(keys[i] >> (BIT_LIMIT_NODE + BIT_LIMIT_INC));
+    }
+    
+    if(node_ids) {
+        for(i = 0; i + 2 <= count; i += 2) {
+            __m128i key = _mm_loadu_si128((const __m128i *)&keys[i]);
+            _mm_storeu_si128((__m128i *)&node_ids[i], _mm_and_si128(_mm_srli_epi64(key, BIT_LIMIT_INC), node_mask));
+        }
+        
+        for(; i < count; i++)
+            node_ids[i] = (unsigned long)((keys[i] >> BIT_LIMIT_INC) & NUMBER_LIMIT_NODE);
+    }
+    
+    if(incs) {
+        for(i = 0; i + 2 <= count; i += 2) {
+            __m128i key = _mm_loadu_si128((const __m128i *)&keys[i]);
+            _mm_storeu_si128((__m128i *)&incs[i], _mm_and_si128(key, inc_mask));
+        }
+        
+        for(; i < count; i++)
+            incs[i] = (unsigned long)(keys[i] & NUMBER_LIMIT);
+    }
+#else
+    if(timestamps) {
+        for(i = 0; i < count; i++)
+            timestamps[i] = (unsigned long)(keys[i] >> (BIT_LIMIT_NODE + BIT_LIMIT_INC));
+    }
+    
+    if(node_ids) {
+        for(i = 0; i < count; i++)
+            node_ids[i] = (unsigned long)((keys[i] >> BIT_LIMIT_INC) & NUMBER_LIMIT_NODE);
+    }
+    
+    if(incs) {
+        for(i = 0; i < count; i++)
+            incs[i] = (unsigned long)(keys[i] & NUMBER_LIMIT);
+    }
+#endif
+}
+
+size_t yauid_get_period_keys_by_grid(time_t start, time_t step, size_t count,
+                                     unsigned long long int from_node_id,
+                                     unsigned long long int to_node_id,
+                                     yauid_period_key *pkeys)
+{
+    if(pkeys == NULL || step <= 0 || start <= 0)
+        return 0;
+    
+    if(from_node_id == 0)
+        from_node_id = LIMIT_MIN_NODE_ID;
+    
+    if(to_node_id == 0)
+        to_node_id = NUMBER_LIMIT_NODE;
+    
+    hkey_t min_low = ((hkey_t)(from_node_id) << BIT_LIMIT_INC) | (hkey_t)(1);
+    hkey_t max_low = ((hkey_t)(to_node_id) << BIT_LIMIT_INC) | (hkey_t)(NUMBER_LIMIT);
+    
+    hkey_t timestamp = (hkey_t)(start);
+    size_t i;
+    
+    for(i = 0; i < count; i++)
+    {
+        hkey_t last = timestamp + (hkey_t)(step) - 1;
+        
+        if(last > NUMBER_LIMIT_TIMESTAMP)
+            break;
+        
+        pkeys[i].min = (timestamp << (BIT_LIMIT_NODE + BIT_LIMIT_INC)) | min_low;
+        pkeys[i].max = (last << (BIT_LIMIT_NODE + BIT_LIMIT_INC)) | max_low;
+        
+        timestamp += (hkey_t)(step);
+    }
+    
+    return i;
+}
+
+static size_t yauid_classify_search(const yauid_period_key *pkeys, size_t pcount, hkey_t key)
+{
+    /* branchless: last window with min <= key */
+    const yauid_period_key *base = pkeys;
+    size_t len = pcount;
+    
+    while(len > 1) {
+        size_t half = len >> 1;
+        base = (base[half].min <= key) ? &base[half] : base;
+        len -= half;
+    }
+    
+    return (size_t)(base - pkeys);
+}
+
+void yauid_classify_keys(const yauid_period_key *pkeys, size_t pcount,
+                         const hkey_t *keys, size_t count, long *idx)
+{
+    size_t i, last = 0;
+    
+    if(pcount == 0) {
+        for(i = 0; i < count; i++)
+            idx[i] = -1;
+        
+        return;
+    }
+    
+    for(i = 0; i < count; i++)
+    {
+        hkey_t key = keys[i];
+        
+        if(key < pkeys[last].min || (last + 1 < pcount && key >= pkeys[last + 1].min)) {
+            /* sorted input usually moves to the next window */
+            if(last + 1 < pcount && key >= pkeys[last + 1].min &&
+               (last + 2 == pcount || key < pkeys[last + 2].min))
+                last++;
+            else
+                last = yauid_classify_search(pkeys, pcount, key);
+        }
+        
+        idx[i] = (key >= pkeys[last].min && key <= pkeys[last].max) ? (long)(last) : -1L;
+    }
+}
+
+void yauid_validate_init(yauid_validate *rules, time_t now, time_t past, time_t future)
+{
+    if(now == 0)
+        now = time(NULL);
+    
+    rules->from_timestamp = (now > past) ? (unsigned long)(now - past) : 1UL;
+    rules->to_timestamp   = (unsigned long)(now + future);
+    rules->from_node_id   = LIMIT_MIN_NODE_ID;
+    rules->to_node_id     = NUMBER_LIMIT_NODE;
+    rules->nodes          = NULL;
+    
+    if(rules->to_timestamp > NUMBER_LIMIT_TIMESTAMP)
+        rules->to_timestamp = NUMBER_LIMIT_TIMESTAMP;
+}
+
+/* 1 if key is valid; no branches, unsigned wrap checks both bounds of a range */
+static inline uint64_t yauid_validate_key(const yauid_validate *rules, hkey_t key)
+{
+    hkey_t timestamp = key >> (BIT_LIMIT_NODE + BIT_LIMIT_INC);
+    hkey_t node_id   = (key >> BIT_LIMIT_INC) & NUMBER_LIMIT_NODE;
+    hkey_t inc       = key & NUMBER_LIMIT;
+    
+    return (uint64_t)((timestamp - rules->from_timestamp) <= (hkey_t)(rules->to_timestamp - rules->from_timestamp)) &
+           (uint64_t)((node_id - rules->from_node_id) <= (hkey_t)(rules->to_node_id - rules->from_node_id)) &
+           (uint64_t)(inc != 0);
+}
+
+/* inverted range would make the wrap check above accept every key */
+static int yauid_validate_rules(const yauid_validate *rules)
+{
+    return rules->from_timestamp <= rules->to_timestamp && rules->from_node_id <= rules->to_node_id;
+}
+
+static inline uint64_t yauid_validate_node(const uint8_t *nodes, hkey_t key)
+{
+    hkey_t node_id = (key >> BIT_LIMIT_INC) & NUMBER_LIMIT_NODE;
+    return (uint64_t)((nodes[node_id >> 3] >> (node_id & 7)) & 1);
+}
+
+#ifdef YAUID_BATCH_AVX2
+
+/*
+ * AVX2 has signed 64-bit compare only: fields of a key are far below 2^63,
+ * so the bounds are clamped to one past the field maximum and compared signed
+ */
+__attribute__((target("avx2")))
+static inline __m256i yauid_validate_range_avx2(__m256i value, unsigned long from, unsigned long to, uint64_t limit)
+{
+    __m256i lo = _mm256_set1_epi64x((long long)(from < limit ? from : limit));
+    __m256i hi = _mm256_set1_epi64x((long long)(to < limit ? to : limit));
+    
+    /* all ones if value < from or value > to */
+    return _mm256_or_si256(_mm256_cmpgt_epi64(lo, value), _mm256_cmpgt_epi64(value, hi));
+}
+
+/* full 64-key words only; returns number of keys processed */
+__attribute__((target("avx2")))
+static size_t yauid_validate_batch_avx2(const yauid_validate *rules, const hkey_t *keys, size_t count,
+                                        uint64_t *mask, size_t *valid)
+{
+    const __m256i node_mask = _mm256_set1_epi64x(NUMBER_LIMIT_NODE);
+    const __m256i inc_mask  = _mm256_set1_epi64x(NUMBER_LIMIT);
+    const __m256i bit_mask  = _mm256_set1_epi64x(31);
+    const __m256i one       = _mm256_set1_epi64x(1);
+    const __m256i zero      = _mm256_setzero_si256();
+    
+    size_t i, j, total = 0;
+    
+    for(i = 0; i + 64 <= count; i += 64)
+    {
+        uint64_t word = 0;
+        
+        for(j = 0; j < 64; j += 4)
+        {
+            __m256i key  = _mm256_loadu_si256((const __m256i *)&keys[i + j]);
+            __m256i node = _mm256_and_si256(_mm256_srli_epi64(key, BIT_LIMIT_INC), node_mask);
+            
+            __m256i bad = yauid_validate_range_avx2(_mm256_srli_epi64(key, BIT_LIMIT_NODE + BIT_LIMIT_INC),
+                                                    rules->from_timestamp, rules->to_timestamp,
+                                                    (uint64_t)1 << BIT_LIMIT_TIMESTAMP);
+            
+            bad = _mm256_or_si256(bad, yauid_validate_range_avx2(node, rules->from_node_id, rules->to_node_id,
+                                                                 (uint64_t)NUMBER_LIMIT_NODE + 1));
+            bad = _mm256_or_si256(bad, _mm256_cmpeq_epi64(_mm256_and_si256(key, inc_mask), zero));
+            
+            if(rules->nodes) {
+                /* 32-bit word node_id / 32 of the bitmap, always inside YAUID_VALIDATE_NODES_SIZE */
+                __m256i bits = _mm256_cvtepu32_epi64(_mm256_i64gather_epi32((const int *)rules->nodes,
+                                                                    _mm256_srli_epi64(node, 5), 4));
+                bits = _mm256_and_si256(_mm256_srlv_epi64(bits, _mm256_and_si256(node, bit_mask)), one);
+                bad  = _mm256_or_si256(bad, _mm256_cmpeq_epi64(bits, zero));
+            }
+            
+            word |= (uint64_t)(~_mm256_movemask_pd(_mm256_castsi256_pd(bad)) & 0xf) << j;
+        }
+        
+        mask[i >> 6] = word;
+        total += (size_t)__builtin_popcountll(word);
+    }
+    
+    *valid = total;
+    return i;
+}
+
+#endif /* YAUID_BATCH_AVX2 */
+
+size_t yauid_validate_batch(const yauid_validate *rules, const hkey_t *keys, size_t count, uint64_t *mask)
+{
+    size_t i = 0, j, valid = 0;
+    
+    if(yauid_validate_rules(rules) == 0) {
+        memset(mask, 0, ((count + 63) >> 6) * sizeof(uint64_t));
+        return 0;
+    }
+    
+#ifdef YAUID_BATCH_AVX2
+    if(__builtin_cpu_supports("avx2"))
+        i = yauid_validate_batch_avx2(rules, keys, count, mask, &valid);
+#endif
+    
+    for(; i < count; i += 64)
+    {
+        size_t len = (count - i < 64) ? (count - i) : 64;
+        uint64_t word = 0;
+        
+        if(rules->nodes) {
+            for(j = 0; j < len; j++)
+                word |= (yauid_validate_key(rules, keys[i + j]) & yauid_validate_node(rules->nodes, keys[i + j])) << j;
+        }
+        else {
+            for(j = 0; j < len; j++)
+                word |= yauid_validate_key(rules, keys[i + j]) << j;
+        }
+        
+        mask[i >> 6] = word;
+        valid += (size_t)__builtin_popcountll(word);
+    }
+    
+    return valid;
+}
+
+size_t yauid_validate_compact(const yauid_validate *rules, const hkey_t *keys, size_t count, hkey_t *valid)
+{
+    size_t i, len = 0;
+    
+    if(yauid_validate_rules(rules) == 0)
+        return 0;
+    
+    /* unconditional store, the cursor moves only for valid keys */
+    if(rules->nodes) {
+        for(i = 0; i < count; i++) {
+            hkey_t key = keys[i];
+            
+            valid[len] = key;
+            len += (size_t)(yauid_validate_key(rules, key) & yauid_validate_node(rules->nodes, key));
+        }
+    }
+    else {
+        for(i = 0; i < count; i++) {
+            hkey_t key = keys[i];
+            
+            valid[len] = key;
+            len += (size_t)yauid_validate_key(rules, key);
+        }
+    }
+    
+    return len;
+}
+
@@ -0,0 +1,166 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <yauid_dup.h>
+
+#define YAUID_DUP_PREFETCH 8
+
+yauid_dup * yauid_dup_create(size_t seconds, size_t keys_per_second)
+{
+    if(seconds == 0 || keys_per_second == 0)
+        return NULL;
+    
+    yauid_dup* dup = (yauid_dup *)calloc(1, sizeof(yauid_dup));
+    if(dup == NULL)
+        return NULL;
+    
+    /* load factor <= 1/2 */
+    dup->seconds  = seconds;
+    dup->limit    = keys_per_second;
+    dup->capacity = 2;
+    
+    while(dup->capacity < keys_per_second * 2)
+        dup->capacity <<= 1;
+    
+    dup->ring      = (yauid_dup_second *)calloc(seconds, sizeof(yauid_dup_second));
+    dup->keys      = (hkey_t *)calloc(seconds * dup->capacity, sizeof(hkey_t));
+    dup->node_dups = (uint64_t *)calloc(NUMBER_LIMIT_NODE + 1, sizeof(uint64_t));
+    
+    if(dup->ring == NULL || dup->keys == NULL || dup->node_dups == NULL) {
+        yauid_dup_destroy(dup);
+        return NULL;
+    }
+    
+    size_t i;
+    for(i = 0; i < seconds; i++)
+        dup->ring[i].keys = &dup->keys[i * dup->capacity];
+    
+    return dup;
+}
+
+void yauid_dup_destroy(yauid_dup* dup)
+{
+    if(dup == NULL)
+        return;
+    
+    free(dup->ring);
+    free(dup->keys);
+    free(dup->node_dups);
+    
+    free(dup);
+}
+
+static inline size_t yauid_dup_hash(yauid_dup* dup, hkey_t key)
+{
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (dup->capacity - 1);
+}
+
+static inline yauid_dup_second * yauid_dup_second_get(yauid_dup* dup, hkey_t key)
+{
+    uint64_t timestamp = key >> (BIT_LIMIT_NODE + BIT_LIMIT_INC);
+    return &dup->ring[timestamp % dup->seconds];
+}
+
+/* returns 1 if key was seen */
+static int yauid_dup_check(yauid_dup* dup, hkey_t key)
+{
+    uint64_t timestamp = key >> (BIT_LIMIT_NODE + BIT_LIMIT_INC);
+    yauid_dup_second *second = yauid_dup_second_get(dup, key);
+    
+    if(second->timestamp != timestamp)
+    {
+        if(second->timestamp > timestamp) {
+            dup->late++;
+            return 0;
+        }
+        
+        if(second->used)
+            memset(second->keys, 0, sizeof(hkey_t) * dup->capacity);
+        
+        second->timestamp = timestamp;
+        second->used = 0;
+    }
+    
+    size_t mask = dup->capacity - 1;
+    size_t pos  = yauid_dup_hash(dup, key);
+    
+    for(;;)
+    {
+        if(second->keys[pos] == key)
+            return 1;
+        
+        if(second->keys[pos] == 0)
+            break;
+        
+        pos = (pos + 1) & mask;
+    }
+    
+    if(second->used >= dup->limit) {
+        dup->overflow++;
+        return 0;
+    }
+    
+    second->keys[pos] = key;
+    second->used++;
+    
+    return 0;
+}
+
+size_t yauid_dup_feed(yauid_dup* dup, const hkey_t *keys, size_t count)
+{
+    size_t i, found = 0;
+    
+    for(i = 0; i < count; i++)
+    {
+        /* bring the hash slot of a later key into cache */
+        if(i + YAUID_DUP_PREFETCH < count) {
+            hkey_t next = keys[i + YAUID_DUP_PREFETCH];
+            __builtin_prefetch(&yauid_dup_second_get(dup, next)->keys[ yauid_dup_hash(dup, next) ], 0, 1);
+        }
+        
+        if(keys[i] == 0)
+            continue;
+        
+        if(yauid_dup_check(dup, keys[i])) {
+            dup->node_dups[ yauid_get_node_id(keys[i]) ]++;
+            found++;
+        }
+    }
+    
+    dup->count += count;
+    dup->dups  += found;
+    
+    return found;
+}
+
+size_t yauid_dup_nodes(yauid_dup* dup, unsigned long *node_ids, size_t size)
+{
+    size_t i, len = 0;
+    
+    for(i = 0; i <= NUMBER_LIMIT_NODE; i++)
+    {
+        if(dup->node_dups[i] == 0)
+            continue;
+        
+        if(node_ids && len < size)
+            node_ids[len] = (unsigned long)i;
+        
+        len++;
+    }
+    
+    return len;
+}
+
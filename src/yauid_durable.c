@@ -0,0 +1,152 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <yauid.h>
+#include <pthread.h>
+#include "yauid_durable.h"
+
+#if defined(__APPLE__)
+#define yauid_durable_sync(fd) fsync(fd)
+#else
+#define yauid_durable_sync(fd) fdatasync(fd)
+#endif
+
+struct yauid_durable {
+    int fd;
+    useconds_t interval_usec;
+    
+    pthread_mutex_t write_mutex;
+    
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint64_t written;        /* last write */
+    uint64_t synced;         /* last write on disk */
+    uint64_t failed;         /* last write of a failed sync */
+    int syncing;
+};
+
+void yauid_durable_lock(struct yauid_durable *durable)
+{
+    pthread_mutex_lock(&durable->write_mutex);
+}
+
+void yauid_durable_unlock(struct yauid_durable *durable)
+{
+    pthread_mutex_unlock(&durable->write_mutex);
+}
+
+uint64_t yauid_durable_written(struct yauid_durable *durable)
+{
+    pthread_mutex_lock(&durable->mutex);
+    uint64_t seq = ++durable->written;
+    pthread_mutex_unlock(&durable->mutex);
+    
+    return seq;
+}
+
+useconds_t yauid_durable_interval(struct yauid_durable *durable)
+{
+    return durable->interval_usec;
+}
+
+yauid_status_t yauid_durable_wait(struct yauid_durable *durable, uint64_t seq)
+{
+    yauid_status_t status = YAUID_OK;
+    
+    pthread_mutex_lock(&durable->mutex);
+    
+    for(;;)
+    {
+        if(durable->synced >= seq)
+            break;
+        
+        if(durable->failed >= seq) {
+            status = YAUID_ERROR_SYNC_KEY;
+            break;
+        }
+        
+        if(durable->syncing) {
+            pthread_cond_wait(&durable->cond, &durable->mutex);
+            continue;
+        }
+        
+        /* leader: let other writers join the commit, then sync all written so far */
+        durable->syncing = 1;
+        pthread_mutex_unlock(&durable->mutex);
+        
+        if(durable->interval_usec)
+            usleep(durable->interval_usec);
+        
+        pthread_mutex_lock(&durable->mutex);
+        uint64_t target = durable->written;
+        pthread_mutex_unlock(&durable->mutex);
+        
+        int result = yauid_durable_sync(durable->fd);
+        
+        pthread_mutex_lock(&durable->mutex);
+        
+        if(result == 0)
+            durable->synced = target;
+        else
+            durable->failed = target;
+        
+        durable->syncing = 0;
+        pthread_cond_broadcast(&durable->cond);
+    }
+    
+    pthread_mutex_unlock(&durable->mutex);
+    
+    return status;
+}
+
+yauid_status_t yauid_set_durable(yauid* yaobj, int durable, useconds_t interval_usec)
+{
+    if(yaobj->durable)
+    {
+        pthread_cond_destroy(&yaobj->durable->cond);
+        pthread_mutex_destroy(&yaobj->durable->mutex);
+        pthread_mutex_destroy(&yaobj->durable->write_mutex);
+        
+        free(yaobj->durable);
+        yaobj->durable = NULL;
+    }
+    
+    if(durable == 0)
+        return YAUID_OK;
+    
+    /* lazy lock file is opened by the first key */
+    if(yaobj->h_lockfile == NULL &&
+       (yaobj->backend != &yauid_backend_file_lazy || yaobj->i_lockfile < 0))
+    {
+        return YAUID_ERROR_OPEN_LOCK_FILE;
+    }
+    
+    struct yauid_durable *obj = (struct yauid_durable *)calloc(1, sizeof(struct yauid_durable));
+    if(obj == NULL)
+        return YAUID_ERROR_CREATE_OBJECT;
+    
+    obj->fd = yaobj->i_lockfile;
+    obj->interval_usec = interval_usec;
+    
+    pthread_mutex_init(&obj->write_mutex, NULL);
+    pthread_mutex_init(&obj->mutex, NULL);
+    pthread_cond_init(&obj->cond, NULL);
+    
+    yaobj->durable = obj;
+    
+    return YAUID_OK;
+}
+
@@ -0,0 +1,56 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef yauid_yauid_durable_h
+#define yauid_yauid_durable_h
+
+#include <yauid.h>
+
+/**
+ * Serialize writers of the lock file descriptor of a durable handle
+ *
+ * @param[in] durable
+ */
+void yauid_durable_lock(struct yauid_durable *durable);
+void yauid_durable_unlock(struct yauid_durable *durable);
+
+/**
+ * Count a write of the lock file; must be called under yauid_durable_lock
+ *
+ * @param[in] durable
+ * @return sequence number of the write
+ */
+uint64_t yauid_durable_written(struct yauid_durable *durable);
+
+/**
+ * Wait until the write is synced; one of the waiters syncs for the group
+ *
+ * @param[in] durable
+ * @param[in] sequence number of the write
+ * @return YAUID_OK if successful or YAUID_ERROR_SYNC_KEY
+ */
+yauid_status_t yauid_durable_wait(struct yauid_durable *durable, uint64_t seq);
+
+/**
+ * Get commit interval
+ *
+ * @param[in] durable
+ * @return interval in microseconds
+ */
+useconds_t yauid_durable_interval(struct yauid_durable *durable);
+
+#endif
+
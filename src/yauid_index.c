@@ -0,0 +1,577 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <yauid_index.h>
+#include <yauid_merge.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define YAUID_INDEX_MEMORY_KEYS (16UL * 1024 * 1024)
+#define YAUID_INDEX_CHUNK       4096
+#define YAUID_INDEX_PREFETCH    16
+
+struct yauid_index_builder {
+    char *filepath;
+    
+    hkey_t *buf;
+    hkey_t *tmp;
+    size_t len;
+    size_t capacity;
+    
+    FILE **runs;
+    size_t runs_len;
+    size_t runs_capacity;
+    size_t runs_keys;        /* keys written to runs; checked against the merge */
+};
+
+/***********************************************************************************
+ *
+ * Lookup
+ *
+ ***********************************************************************************/
+
+yauid_index * yauid_index_open(const char *filepath)
+{
+    yauid_index* index = (yauid_index *)calloc(1, sizeof(yauid_index));
+    if(index == NULL)
+        return NULL;
+    
+    index->error = YAUID_OK;
+    
+    int fd = open(filepath, O_RDONLY);
+    if(fd == -1) {
+        index->error = YAUID_ERROR_INDEX_OPEN;
+        return index;
+    }
+    
+    struct stat st;
+    if(fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(yauid_index_header)) {
+        close(fd);
+        index->error = YAUID_ERROR_INDEX_FORMAT;
+        return index;
+    }
+    
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    
+    if(map == MAP_FAILED) {
+        index->error = YAUID_ERROR_INDEX_OPEN;
+        return index;
+    }
+    
+    index->map = map;
+    index->map_size = (size_t)st.st_size;
+    
+    const yauid_index_header *header = (const yauid_index_header *)map;
+    
+    /* keys and directory: count + buckets + 1 words; compared without multiplication */
+    size_t words = (index->map_size - sizeof(yauid_index_header)) / sizeof(uint64_t);
+    
+    if(header->magic != YAUID_INDEX_MAGIC || header->version != YAUID_INDEX_VERSION ||
+       header->endian != YAUID_STATE_ENDIAN || header->bit_timestamp != BIT_LIMIT_TIMESTAMP ||
+       header->bit_node != BIT_LIMIT_NODE || header->bit_inc != BIT_LIMIT_INC ||
+       header->shift >= 64 ||
+       (index->map_size - sizeof(yauid_index_header)) % sizeof(uint64_t) != 0 ||
+       header->count >= words || header->buckets != words - 1 - header->count)
+    {
+        index->error = YAUID_ERROR_INDEX_FORMAT;
+        return index;
+    }
+    
+    index->keys    = (const hkey_t *)((const char *)map + sizeof(yauid_index_header));
+    index->dir     = (const uint64_t *)(index->keys + header->count);
+    index->count   = (size_t)header->count;
+    index->from    = header->from;
+    index->buckets = header->buckets;
+    index->shift   = header->shift;
+    
+    /* lookups trust the directory: positions must not decrease and end at count */
+    size_t i;
+    for(i = 0; i < index->buckets; i++)
+    {
+        if(index->dir[i] > index->dir[i + 1]) {
+            index->error = YAUID_ERROR_INDEX_FORMAT;
+            return index;
+        }
+    }
+    
+    if(index->dir[ index->buckets ] != index->count)
+        index->error = YAUID_ERROR_INDEX_FORMAT;
+    
+    return index;
+}
+
+void yauid_index_close(yauid_index* index)
+{
+    if(index == NULL)
+        return;
+    
+    if(index->map)
+        munmap(index->map, index->map_size);
+    
+    free(index);
+}
+
+/* positions of keys of the directory bucket of key */
+static inline void yauid_index_bucket(const yauid_index* index, hkey_t key, size_t *from, size_t *to)
+{
+    uint64_t timestamp = key >> (BIT_LIMIT_NODE + BIT_LIMIT_INC);
+    
+    if(timestamp < index->from) {
+        *from = *to = 0;
+        return;
+    }
+    
+    uint64_t bucket = (timestamp - index->from) >> index->shift;
+    
+    if(bucket >= index->buckets) {
+        *from = *to = index->count;
+        return;
+    }
+    
+    *from = (size_t)index->dir[bucket];
+    *to   = (size_t)index->dir[bucket + 1];
+}
+
+/* first position with key >= key; branchless */
+static inline size_t yauid_index_lower_bound(const hkey_t *keys, size_t from, size_t to, hkey_t key)
+{
+    if(from == to)
+        return from;
+    
+    const hkey_t *base = &keys[from];
+    size_t len = to - from;
+    
+    while(len > 1) {
+        size_t half = len >> 1;
+        base = (base[half] < key) ? &base[half] : base;
+        len -= half;
+    }
+    
+    return (size_t)(base - keys) + (*base < key);
+}
+
+static inline size_t yauid_index_find(const yauid_index* index, hkey_t key)
+{
+    size_t from, to;
+    
+    yauid_index_bucket(index, key, &from, &to);
+    
+    return yauid_index_lower_bound(index->keys, from, to, key);
+}
+
+int yauid_index_contains(yauid_index* index, hkey_t key)
+{
+    size_t pos = yauid_index_find(index, key);
+    return (pos < index->count && index->keys[pos] == key);
+}
+
+size_t yauid_index_contains_batch(yauid_index* index, const hkey_t *keys, size_t count, uint8_t *found)
+{
+    size_t i, from, to, len = 0;
+    
+    for(i = 0; i < count; i++)
+    {
+        /* two stages ahead: directory entry, then the middle of its keys */
+        if(i + YAUID_INDEX_PREFETCH < count)
+        {
+            uint64_t timestamp = keys[i + YAUID_INDEX_PREFETCH] >> (BIT_LIMIT_NODE + BIT_LIMIT_INC);
+            uint64_t bucket = (timestamp - index->from) >> index->shift;
+            
+            if(timestamp >= index->from && bucket < index->buckets)
+                __builtin_prefetch(&index->dir[bucket], 0, 0);
+        }
+        
+        if(i + (YAUID_INDEX_PREFETCH >> 1) < count)
+        {
+            yauid_index_bucket(index, keys[i + (YAUID_INDEX_PREFETCH >> 1)], &from, &to);
+            
+            if(from < to)
+                __builtin_prefetch(&index->keys[(from + to) >> 1], 0, 0);
+        }
+        
+        size_t pos = yauid_index_find(index, keys[i]);
+        
+        found[i] = (uint8_t)(pos < index->count && index->keys[pos] == keys[i]);
+        len += found[i];
+    }
+    
+    return len;
+}
+
+size_t yauid_index_range(yauid_index* index, hkey_t min, hkey_t max, size_t *first)
+{
+    size_t from = yauid_index_find(index, min);
+    size_t to   = yauid_index_find(index, max);
+    
+    if(to < index->count && index->keys[to] == max)
+        to++;
+    
+    *first = from;
+    
+    return (to > from) ? (to - from) : 0;
+}
+
+/***********************************************************************************
+ *
+ * Builder
+ *
+ ***********************************************************************************/
+
+static int yauid_index_cmp(const void *a, const void *b)
+{
+    hkey_t ka = *((const hkey_t *)a), kb = *((const hkey_t *)b);
+    return (ka > kb) - (ka < kb);
+}
+
+/* LSD radix sort by 16 bit digits; digits equal for all keys are skipped */
+static void yauid_index_sort(hkey_t *keys, hkey_t *tmp, size_t count)
+{
+    size_t *counts = (size_t *)malloc(sizeof(size_t) * 65536);
+    unsigned int shift;
+    size_t i;
+    
+    /* no memory for counters: slower, still correct */
+    if(counts == NULL) {
+        qsort(keys, count, sizeof(hkey_t), yauid_index_cmp);
+        return;
+    }
+    
+    hkey_t *src = keys, *dst = tmp;
+    
+    for(shift = 0; shift < 64; shift += 16)
+    {
+        memset(counts, 0, sizeof(size_t) * 65536);
+        
+        for(i = 0; i < count; i++)
+            counts[(src[i] >> shift) & 0xFFFF]++;
+        
+        if(count == 0 || counts[(src[0] >> shift) & 0xFFFF] == count)
+            continue;
+        
+        size_t sum = 0;
+        for(i = 0; i < 65536; i++) {
+            size_t c = counts[i];
+            counts[i] = sum;
+            sum += c;
+        }
+        
+        for(i = 0; i < count; i++)
+            dst[ counts[(src[i] >> shift) & 0xFFFF]++ ] = src[i];
+        
+        hkey_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    
+    if(src != keys)
+        memcpy(keys, src, sizeof(hkey_t) * count);
+    
+    free(counts);
+}
+
+static size_t yauid_index_unique(hkey_t *keys, size_t count)
+{
+    size_t i, len = (count) ? 1 : 0;
+    
+    for(i = 1; i < count; i++) {
+        keys[len] = keys[i];
+        len += (keys[i] != keys[len - 1]);
+    }
+    
+    return len;
+}
+
+yauid_index_builder * yauid_index_builder_create(const char *filepath, size_t memory_keys)
+{
+    yauid_index_builder* builder = (yauid_index_builder *)calloc(1, sizeof(yauid_index_builder));
+    if(builder == NULL)
+        return NULL;
+    
+    builder->capacity = (memory_keys) ? memory_keys : YAUID_INDEX_MEMORY_KEYS;
+    builder->filepath = strdup(filepath);
+    builder->buf = (hkey_t *)malloc(sizeof(hkey_t) * builder->capacity);
+    builder->tmp = (hkey_t *)malloc(sizeof(hkey_t) * builder->capacity);
+    
+    if(builder->filepath == NULL || builder->buf == NULL || builder->tmp == NULL) {
+        yauid_index_builder_destroy(builder);
+        return NULL;
+    }
+    
+    return builder;
+}
+
+void yauid_index_builder_destroy(yauid_index_builder* builder)
+{
+    if(builder == NULL)
+        return;
+    
+    size_t i;
+    for(i = 0; i < builder->runs_len; i++)
+        fclose(builder->runs[i]);
+    
+    free(builder->runs);
+    free(builder->filepath);
+    free(builder->buf);
+    free(builder->tmp);
+    free(builder);
+}
+
+static yauid_status_t yauid_index_builder_spill(yauid_index_builder* builder)
+{
+    if(builder->runs_len == builder->runs_capacity)
+    {
+        size_t capacity = (builder->runs_capacity) ? (builder->runs_capacity << 1) : 16;
+        FILE **runs = (FILE **)realloc(builder->runs, sizeof(FILE *) * capacity);
+        
+        if(runs == NULL)
+            return YAUID_ERROR_CREATE_OBJECT;
+        
+        builder->runs = runs;
+        builder->runs_capacity = capacity;
+    }
+    
+    yauid_index_sort(builder->buf, builder->tmp, builder->len);
+    builder->len = yauid_index_unique(builder->buf, builder->len);
+    
+    FILE *fh = tmpfile();
+    if(fh == NULL)
+        return YAUID_ERROR_INDEX_WRITE;
+    
+    if(fwrite(builder->buf, sizeof(hkey_t), builder->len, fh) != builder->len || fflush(fh) != 0) {
+        fclose(fh);
+        return YAUID_ERROR_INDEX_WRITE;
+    }
+    
+    rewind(fh);
+    
+    builder->runs[ builder->runs_len++ ] = fh;
+    builder->runs_keys += builder->len;
+    builder->len = 0;
+    
+    return YAUID_OK;
+}
+
+yauid_status_t yauid_index_builder_add(yauid_index_builder* builder, const hkey_t *keys, size_t count)
+{
+    while(count)
+    {
+        size_t len = builder->capacity - builder->len;
+        if(len > count)
+            len = count;
+        
+        memcpy(&builder->buf[ builder->len ], keys, sizeof(hkey_t) * len);
+        
+        builder->len += len;
+        keys  += len;
+        count -= len;
+        
+        if(builder->len == builder->capacity) {
+            yauid_status_t status = yauid_index_builder_spill(builder);
+            
+            if(status != YAUID_OK)
+                return status;
+        }
+    }
+    
+    return YAUID_OK;
+}
+
+static yauid_status_t yauid_index_write_dir(FILE *fh, yauid_index_header *header)
+{
+    uint64_t last = 0;
+    size_t map_size = sizeof(yauid_index_header) + header->count * sizeof(hkey_t);
+    
+    if(fflush(fh) != 0)
+        return YAUID_ERROR_INDEX_WRITE;
+    
+    void *map = NULL;
+    const hkey_t *keys = NULL;
+    
+    if(header->count)
+    {
+        map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fileno(fh), 0);
+        if(map == MAP_FAILED)
+            return YAUID_ERROR_INDEX_WRITE;
+        
+        keys = (const hkey_t *)((const char *)map + sizeof(yauid_index_header));
+        
+        header->from = keys[0] >> (BIT_LIMIT_NODE + BIT_LIMIT_INC);
+        last = keys[header->count - 1] >> (BIT_LIMIT_NODE + BIT_LIMIT_INC);
+        
+        /* directory size is at most half of keys */
+        uint64_t span = last - header->from + 1, limit = (header->count >> 1) + 1;
+        
+        while(((span - 1) >> header->shift) + 1 > limit)
+            header->shift++;
+        
+        header->buckets = ((span - 1) >> header->shift) + 1;
+    }
+    
+    uint64_t dir[YAUID_INDEX_CHUNK];
+    uint64_t bucket = 0;
+    size_t i = 0, len = 0;
+    yauid_status_t status = YAUID_OK;
+    
+    while(bucket <= header->buckets)
+    {
+        uint64_t pos;
+        
+        if(bucket == header->buckets) {
+            pos = header->count;
+        }
+        else {
+            while(i < header->count &&
+                  (((keys[i] >> (BIT_LIMIT_NODE + BIT_LIMIT_INC)) - header->from) >> header->shift) < bucket)
+                i++;
+            
+            pos = i;
+        }
+        
+        dir[len++] = pos;
+        bucket++;
+        
+        if(len == YAUID_INDEX_CHUNK || bucket > header->buckets) {
+            if(fwrite(dir, sizeof(uint64_t), len, fh) != len) {
+                status = YAUID_ERROR_INDEX_WRITE;
+                break;
+            }
+            
+            len = 0;
+        }
+    }
+    
+    if(map)
+        munmap(map, map_size);
+    
+    return status;
+}
+
+yauid_status_t yauid_index_builder_finish(yauid_index_builder* builder)
+{
+    yauid_status_t status = YAUID_OK;
+    yauid_merge* merge = NULL;
+    
+    if(builder->runs_len)
+    {
+        if(builder->len && (status = yauid_index_builder_spill(builder)) != YAUID_OK)
+            return status;
+        
+        /* no dedup in merge: every key of runs is counted, duplicates are dropped below */
+        if((merge = yauid_merge_create(0)) == NULL)
+            return YAUID_ERROR_CREATE_OBJECT;
+        
+        size_t i;
+        for(i = 0; i < builder->runs_len; i++) {
+            if((status = yauid_merge_add_file(merge, builder->runs[i])) != YAUID_OK) {
+                yauid_merge_destroy(merge);
+                return status;
+            }
+        }
+    }
+    else {
+        yauid_index_sort(builder->buf, builder->tmp, builder->len);
+        builder->len = yauid_index_unique(builder->buf, builder->len);
+    }
+    
+    FILE *fh = fopen(builder->filepath, "wb+");
+    if(fh == NULL) {
+        yauid_merge_destroy(merge);
+        return YAUID_ERROR_INDEX_OPEN;
+    }
+    
+    yauid_index_header header;
+    memset(&header, 0, sizeof(yauid_index_header));
+    
+    header.magic         = YAUID_INDEX_MAGIC;
+    header.version       = YAUID_INDEX_VERSION;
+    header.endian        = YAUID_STATE_ENDIAN;
+    header.bit_timestamp = BIT_LIMIT_TIMESTAMP;
+    header.bit_node      = BIT_LIMIT_NODE;
+    header.bit_inc       = BIT_LIMIT_INC;
+    
+    if(fwrite(&header, sizeof(yauid_index_header), 1, fh) != 1)
+        status = YAUID_ERROR_INDEX_WRITE;
+    
+    if(status == YAUID_OK)
+    {
+        if(merge) {
+            size_t i, len, merged = 0;
+            hkey_t last = (hkey_t)(0);
+            
+            while((len = yauid_merge_read(merge, builder->buf, builder->capacity)))
+            {
+                size_t unique = 0;
+                
+                for(i = 0; i < len; i++) {
+                    if((merged + i) == 0 || builder->buf[i] != last)
+                        builder->buf[unique++] = builder->buf[i];
+                    
+                    last = builder->buf[i];
+                }
+                
+                merged += len;
+                
+                if(fwrite(builder->buf, sizeof(hkey_t), unique, fh) != unique) {
+                    status = YAUID_ERROR_INDEX_WRITE;
+                    break;
+                }
+                
+                header.count += unique;
+            }
+            
+            /* 0 from merge is also a read error: never write a truncated index */
+            if(status == YAUID_OK && yauid_merge_get_error(merge) != YAUID_OK)
+                status = yauid_merge_get_error(merge);
+            
+            for(i = 0; status == YAUID_OK && i < builder->runs_len; i++) {
+                if(ferror(builder->runs[i]))
+                    status = YAUID_ERROR_READ_KEY;
+            }
+            
+            if(status == YAUID_OK && merged != builder->runs_keys)
+                status = YAUID_ERROR_READ_KEY;
+        }
+        else {
+            if(fwrite(builder->buf, sizeof(hkey_t), builder->len, fh) != builder->len)
+                status = YAUID_ERROR_INDEX_WRITE;
+            
+            header.count = builder->len;
+        }
+    }
+    
+    if(status == YAUID_OK)
+        status = yauid_index_write_dir(fh, &header);
+    
+    if(status == YAUID_OK) {
+        if(fseek(fh, 0L, SEEK_SET) != 0 || fwrite(&header, sizeof(yauid_index_header), 1, fh) != 1)
+            status = YAUID_ERROR_INDEX_WRITE;
+    }
+    
+    if(fclose(fh) != 0 && status == YAUID_OK)
+        status = YAUID_ERROR_INDEX_WRITE;
+    
+    if(status != YAUID_OK)
+        unlink(builder->filepath);
+    
+    yauid_merge_destroy(merge);
+    
+    builder->len = 0;
+    
+    return status;
+}
+
@@ -0,0 +1,512 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <yauid_merge.h>
+#include <pthread.h>
+
+#define YAUID_MERGE_BUFFER  1024
+#define YAUID_MERGE_SAMPLES 64
+#define YAUID_MERGE_END     ((hkey_t)(-1))
+
+struct yauid_merge_source {
+    const hkey_t *keys;      /* current block: array itself or buf */
+    size_t pos;
+    size_t len;
+    int done;
+    
+    hkey_t *buf;
+    yauid_merge_read_f read;
+    void *ctx;
+}
+typedef yauid_merge_source;
+
+struct yauid_merge {
+    yauid_merge_source *sources;
+    size_t size;
+    size_t capacity;
+    
+    size_t *tree;            /* tree[0] = winner, tree[1..size-1] = losers */
+    hkey_t *heads;           /* current key of every source; YAUID_MERGE_END when done */
+    int started;
+    yauid_status_t error;
+    int dedup;
+    int has_last;
+    hkey_t last;
+};
+
+static size_t yauid_merge_read_file(void *ctx, hkey_t *keys, size_t count)
+{
+    return fread((void *)keys, sizeof(hkey_t), count, (FILE *)ctx);
+}
+
+yauid_merge * yauid_merge_create(int dedup)
+{
+    yauid_merge* merge = (yauid_merge *)calloc(1, sizeof(yauid_merge));
+    
+    if(merge)
+        merge->dedup = dedup;
+    
+    return merge;
+}
+
+void yauid_merge_destroy(yauid_merge* merge)
+{
+    if(merge == NULL)
+        return;
+    
+    size_t i;
+    for(i = 0; i < merge->size; i++)
+        free(merge->sources[i].buf);
+    
+    free(merge->sources);
+    free(merge->tree);
+    free(merge->heads);
+    free(merge);
+}
+
+static yauid_merge_source * yauid_merge_add(yauid_merge* merge)
+{
+    if(merge->size == merge->capacity)
+    {
+        size_t capacity = (merge->capacity) ? (merge->capacity << 1) : 16;
+        yauid_merge_source *sources = (yauid_merge_source *)realloc(merge->sources, sizeof(yauid_merge_source) * capacity);
+        
+        if(sources == NULL)
+            return NULL;
+        
+        merge->sources  = sources;
+        merge->capacity = capacity;
+    }
+    
+    yauid_merge_source *source = &merge->sources[merge->size];
+    memset(source, 0, sizeof(yauid_merge_source));
+    
+    merge->size++;
+    
+    return source;
+}
+
+yauid_status_t yauid_merge_add_reader(yauid_merge* merge, yauid_merge_read_f read, void *ctx)
+{
+    if(merge->started)
+        return YAUID_ERROR_MERGE_STARTED;
+    
+    hkey_t *buf = (hkey_t *)malloc(sizeof(hkey_t) * YAUID_MERGE_BUFFER);
+    if(buf == NULL)
+        return YAUID_ERROR_CREATE_OBJECT;
+    
+    yauid_merge_source *source = yauid_merge_add(merge);
+    if(source == NULL) {
+        free(buf);
+        return YAUID_ERROR_CREATE_OBJECT;
+    }
+    
+    source->buf  = buf;
+    source->keys = buf;
+    source->read = read;
+    source->ctx  = ctx;
+    
+    return YAUID_OK;
+}
+
+yauid_status_t yauid_merge_add_array(yauid_merge* merge, const hkey_t *keys, size_t count)
+{
+    if(merge->started)
+        return YAUID_ERROR_MERGE_STARTED;
+    
+    yauid_merge_source *source = yauid_merge_add(merge);
+    if(source == NULL)
+        return YAUID_ERROR_CREATE_OBJECT;
+    
+    source->keys = keys;
+    source->len  = count;
+    
+    return YAUID_OK;
+}
+
+yauid_status_t yauid_merge_add_file(yauid_merge* merge, FILE *fh)
+{
+    return yauid_merge_add_reader(merge, yauid_merge_read_file, (void *)fh);
+}
+
+static void yauid_merge_fill(yauid_merge* merge, size_t idx)
+{
+    yauid_merge_source *source = &merge->sources[idx];
+    
+    source->pos = 0;
+    source->len = (source->read) ? source->read(source->ctx, source->buf, YAUID_MERGE_BUFFER) : 0;
+    
+    if(source->len == 0) {
+        source->done = 1;
+        
+        /* end of stream or error of a file or nested merge */
+        if(source->read == yauid_merge_read_file && ferror((FILE *)source->ctx))
+            merge->error = YAUID_ERROR_READ_KEY;
+        else if(source->read == (yauid_merge_read_f)yauid_merge_read && ((yauid_merge *)source->ctx)->error != YAUID_OK)
+            merge->error = ((yauid_merge *)source->ctx)->error;
+    }
+}
+
+static inline void yauid_merge_head(yauid_merge* merge, size_t idx)
+{
+    const yauid_merge_source *source = &merge->sources[idx];
+    merge->heads[idx] = (source->done) ? YAUID_MERGE_END : source->keys[source->pos];
+}
+
+/* equal heads: ended sources go after YAUID_MERGE_END keys, then the lower source first */
+static int yauid_merge_tie(const yauid_merge* merge, size_t a, size_t b)
+{
+    int da = merge->sources[a].done, db = merge->sources[b].done;
+    
+    if(da != db)
+        return db;
+    
+    return a < b;
+}
+
+/* a before b; done flags are looked at on a tie only */
+static inline int yauid_merge_less(const yauid_merge* merge, size_t a, size_t b)
+{
+    hkey_t ka = merge->heads[a], kb = merge->heads[b];
+    
+    if(ka != kb)
+        return ka < kb;
+    
+    return yauid_merge_tie(merge, a, b);
+}
+
+static yauid_status_t yauid_merge_start(yauid_merge* merge)
+{
+    size_t i, size = merge->size;
+    
+    if(size == 0) {
+        merge->started = 1;
+        return YAUID_OK;
+    }
+    
+    size_t *tree   = (size_t *)malloc(sizeof(size_t) * size);
+    size_t *winner = (size_t *)malloc(sizeof(size_t) * size * 2);
+    hkey_t *heads  = (hkey_t *)malloc(sizeof(hkey_t) * size);
+    
+    if(tree == NULL || winner == NULL || heads == NULL) {
+        free(tree);
+        free(winner);
+        free(heads);
+        
+        return YAUID_ERROR_CREATE_OBJECT;
+    }
+    
+    merge->tree  = tree;
+    merge->heads = heads;
+    
+    for(i = 0; i < size; i++) {
+        if(merge->sources[i].pos >= merge->sources[i].len)
+            yauid_merge_fill(merge, i);
+        
+        yauid_merge_head(merge, i);
+    }
+    
+    /* leaves are size..2*size-1; play matches up to the root */
+    for(i = 0; i < size; i++)
+        winner[size + i] = i;
+    
+    for(i = size - 1; i > 0; i--)
+    {
+        size_t a = winner[i * 2], b = winner[i * 2 + 1];
+        
+        if(yauid_merge_less(merge, b, a)) {
+            winner[i] = b;
+            tree[i] = a;
+        }
+        else {
+            winner[i] = a;
+            tree[i] = b;
+        }
+    }
+    
+    tree[0] = winner[1];
+    
+    free(winner);
+    
+    merge->started = 1;
+    
+    return YAUID_OK;
+}
+
+size_t yauid_merge_read(yauid_merge* merge, hkey_t *keys, size_t count)
+{
+    if(merge->error != YAUID_OK)
+        return 0;
+    
+    if(merge->started == 0) {
+        yauid_status_t status = yauid_merge_start(merge);
+        
+        if(status != YAUID_OK)
+            merge->error = status;
+        
+        if(merge->error != YAUID_OK)
+            return 0;
+    }
+    
+    if(merge->size == 0)
+        return 0;
+    
+    yauid_merge_source *sources = merge->sources;
+    size_t *tree = merge->tree;
+    hkey_t *heads = merge->heads;
+    size_t size = merge->size, len = 0;
+    
+    while(len < count)
+    {
+        size_t win = tree[0];
+        yauid_merge_source *source = &sources[win];
+        
+        if(source->done)
+            break;
+        
+        hkey_t key = heads[win];
+        
+        if(merge->dedup == 0 || merge->has_last == 0 || key != merge->last) {
+            keys[len++] = key;
+            
+            merge->last = key;
+            merge->has_last = 1;
+        }
+        
+        if(++source->pos == source->len) {
+            yauid_merge_fill(merge, win);
+            
+            if(merge->error != YAUID_OK)
+                break;
+        }
+        
+        yauid_merge_head(merge, win);
+        
+        /* replay matches on the path of the winner leaf */
+        hkey_t wkey = heads[win];
+        size_t node = (win + size) >> 1;
+        
+        while(node) {
+            size_t other = tree[node];
+            hkey_t okey = heads[other];
+            
+            if(okey < wkey || (okey == wkey && yauid_merge_tie(merge, other, win))) {
+                tree[node] = win;
+                win  = other;
+                wkey = okey;
+            }
+            
+            node >>= 1;
+        }
+        
+        tree[0] = win;
+    }
+    
+    return len;
+}
+
+yauid_status_t yauid_merge_get_error(yauid_merge* merge)
+{
+    return merge->error;
+}
+
+/***********************************************************************************
+ *
+ * Parallel merge of arrays
+ *
+ ***********************************************************************************/
+
+struct yauid_merge_part {
+    const hkey_t **arrays;
+    size_t *from;            /* from[i]..to[i] of array i */
+    size_t *to;
+    size_t size;
+    
+    hkey_t *keys;
+    size_t count;
+    int dedup;
+    int error;
+}
+typedef yauid_merge_part;
+
+static void * yauid_merge_part_thread(void *arg)
+{
+    yauid_merge_part *part = (yauid_merge_part *)arg;
+    yauid_merge* merge = yauid_merge_create(part->dedup);
+    
+    if(merge == NULL) {
+        part->error = 1;
+        return NULL;
+    }
+    
+    size_t i, len, total = 0;
+    
+    for(i = 0; i < part->size; i++)
+    {
+        if(part->to[i] > part->from[i] &&
+           yauid_merge_add_array(merge, &part->arrays[i][ part->from[i] ], part->to[i] - part->from[i]) != YAUID_OK)
+        {
+            part->error = 1;
+            yauid_merge_destroy(merge);
+            
+            return NULL;
+        }
+        
+        total += part->to[i] - part->from[i];
+    }
+    
+    part->count = 0;
+    
+    while((len = yauid_merge_read(merge, &part->keys[part->count], total - part->count)))
+        part->count += len;
+    
+    if(yauid_merge_get_error(merge) != YAUID_OK)
+        part->error = 1;
+    
+    yauid_merge_destroy(merge);
+    
+    return NULL;
+}
+
+static int yauid_merge_cmp(const void *a, const void *b)
+{
+    hkey_t ka = *((const hkey_t *)a), kb = *((const hkey_t *)b);
+    return (ka > kb) - (ka < kb);
+}
+
+static size_t yauid_merge_lower_bound(const hkey_t *keys, size_t count, hkey_t key)
+{
+    size_t from = 0, to = count;
+    
+    while(from < to) {
+        size_t mid = from + ((to - from) >> 1);
+        
+        if(keys[mid] < key)
+            from = mid + 1;
+        else
+            to = mid;
+    }
+    
+    return from;
+}
+
+size_t yauid_merge_arrays(const hkey_t **arrays, const size_t *counts, size_t size,
+                          hkey_t *keys, int dedup, unsigned int threads)
+{
+    size_t i, j, total = 0, samples_len = 0;
+    
+    if(threads == 0)
+        threads = 1;
+    
+    for(i = 0; i < size; i++)
+        total += counts[i];
+    
+    hkey_t *samples = (hkey_t *)malloc(sizeof(hkey_t) * (size * YAUID_MERGE_SAMPLES + 1));
+    hkey_t *bounds  = (hkey_t *)malloc(sizeof(hkey_t) * (threads + 1));
+    size_t *pos     = (size_t *)malloc(sizeof(size_t) * size * (threads + 1));
+    yauid_merge_part *parts = (yauid_merge_part *)calloc(threads, sizeof(yauid_merge_part));
+    pthread_t *ids  = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+    
+    if(samples == NULL || bounds == NULL || pos == NULL || parts == NULL || ids == NULL) {
+        total = 0;
+        goto done;
+    }
+    
+    /* split points: first key of the second at every quantile of samples */
+    for(i = 0; i < size; i++) {
+        size_t step = (counts[i] > YAUID_MERGE_SAMPLES) ? (counts[i] / YAUID_MERGE_SAMPLES) : 1;
+        
+        for(j = 0; j < counts[i] && j < step * YAUID_MERGE_SAMPLES; j += step)
+            samples[samples_len++] = arrays[i][j];
+    }
+    
+    qsort(samples, samples_len, sizeof(hkey_t), yauid_merge_cmp);
+    
+    size_t parts_len = 1;
+    bounds[0] = 0;
+    
+    for(i = 1; i < threads && samples_len; i++)
+    {
+        hkey_t bound = samples[(i * samples_len) / threads];
+        bound = (bound >> (BIT_LIMIT_NODE + BIT_LIMIT_INC)) << (BIT_LIMIT_NODE + BIT_LIMIT_INC);
+        
+        if(bound > bounds[parts_len - 1])
+            bounds[parts_len++] = bound;
+    }
+    
+    for(i = 0; i < size; i++)
+    {
+        pos[i] = 0;
+        
+        for(j = 1; j < parts_len; j++)
+            pos[j * size + i] = yauid_merge_lower_bound(arrays[i], counts[i], bounds[j]);
+        
+        pos[parts_len * size + i] = counts[i];
+    }
+    
+    size_t offset = 0;
+    
+    for(j = 0; j < parts_len; j++)
+    {
+        parts[j].arrays = arrays;
+        parts[j].from   = &pos[j * size];
+        parts[j].to     = &pos[(j + 1) * size];
+        parts[j].size   = size;
+        parts[j].keys   = &keys[offset];
+        parts[j].dedup  = dedup;
+        
+        for(i = 0; i < size; i++)
+            offset += parts[j].to[i] - parts[j].from[i];
+    }
+    
+    for(j = 1; j < parts_len; j++) {
+        if(pthread_create(&ids[j], NULL, yauid_merge_part_thread, &parts[j]) != 0)
+            parts[j].error = 2;
+    }
+    
+    yauid_merge_part_thread(&parts[0]);
+    
+    for(j = 1; j < parts_len; j++) {
+        if(parts[j].error != 2)
+            pthread_join(ids[j], NULL);
+    }
+    
+    /* parts were written at offsets without dedup, close the gaps */
+    total = 0;
+    
+    for(j = 0; j < parts_len; j++)
+    {
+        if(parts[j].error) {
+            total = 0;
+            break;
+        }
+        
+        if(&keys[total] != parts[j].keys)
+            memmove(&keys[total], parts[j].keys, sizeof(hkey_t) * parts[j].count);
+        
+        total += parts[j].count;
+    }
+    
+done:
+    free(samples);
+    free(bounds);
+    free(pos);
+    free(parts);
+    free(ids);
+    
+    return total;
+}
+
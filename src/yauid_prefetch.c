@@ -0,0 +1,317 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <yauid.h>
+#include <pthread.h>
+#include "yauid_prefetch.h"
+#include "yauid_durable.h"
+
+#define YAUID_PREFETCH_BATCH 1024
+#define YAUID_CACHE_LINE     64
+
+/* bounded MPMC queue of D. Vyukov: every cell has a sequence number */
+struct yauid_prefetch_cell {
+    size_t seq;
+    hkey_t key;
+}
+typedef yauid_prefetch_cell;
+
+struct yauid_prefetch {
+    yauid_prefetch_cell *cells;
+    size_t mask;
+    size_t low_watermark;
+    unsigned int max_age;
+    
+    yauid* producer;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_mutex_t miss_mutex;
+    int stop;
+    int sleeping;
+    
+    size_t enqueue __attribute__((aligned(YAUID_CACHE_LINE)));
+    size_t dequeue __attribute__((aligned(YAUID_CACHE_LINE)));
+    
+    uint64_t hits __attribute__((aligned(YAUID_CACHE_LINE)));
+    uint64_t misses;
+    uint64_t stale;
+};
+
+static size_t yauid_prefetch_count(struct yauid_prefetch *prefetch)
+{
+    size_t enqueue = __atomic_load_n(&prefetch->enqueue, __ATOMIC_SEQ_CST);
+    size_t dequeue = __atomic_load_n(&prefetch->dequeue, __ATOMIC_SEQ_CST);
+    
+    return (enqueue > dequeue) ? (enqueue - dequeue) : 0;
+}
+
+static int yauid_prefetch_push(struct yauid_prefetch *prefetch, hkey_t key)
+{
+    yauid_prefetch_cell *cell;
+    size_t pos = __atomic_load_n(&prefetch->enqueue, __ATOMIC_RELAXED);
+    
+    for(;;)
+    {
+        cell = &prefetch->cells[pos & prefetch->mask];
+        
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&prefetch->enqueue, &pos, pos + 1, 1,
+                                           __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                break;
+        }
+        else if(diff < 0)
+            return 0;
+        else
+            pos = __atomic_load_n(&prefetch->enqueue, __ATOMIC_RELAXED);
+    }
+    
+    cell->key = key;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    
+    return 1;
+}
+
+static hkey_t yauid_prefetch_take(struct yauid_prefetch *prefetch)
+{
+    yauid_prefetch_cell *cell;
+    size_t pos = __atomic_load_n(&prefetch->dequeue, __ATOMIC_RELAXED);
+    
+    for(;;)
+    {
+        cell = &prefetch->cells[pos & prefetch->mask];
+        
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&prefetch->dequeue, &pos, pos + 1, 1,
+                                           __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                break;
+        }
+        else if(diff < 0)
+            return (hkey_t)(0);
+        else
+            pos = __atomic_load_n(&prefetch->dequeue, __ATOMIC_RELAXED);
+    }
+    
+    hkey_t key = cell->key;
+    __atomic_store_n(&cell->seq, pos + prefetch->mask + 1, __ATOMIC_RELEASE);
+    
+    return key;
+}
+
+static void * yauid_prefetch_thread(void *arg)
+{
+    struct yauid_prefetch *prefetch = (struct yauid_prefetch *)arg;
+    hkey_t keys[YAUID_PREFETCH_BATCH];
+    
+    pthread_mutex_lock(&prefetch->mutex);
+    
+    while(prefetch->stop == 0)
+    {
+        size_t fill = yauid_prefetch_count(prefetch);
+        
+        if(fill < prefetch->low_watermark)
+        {
+            pthread_mutex_unlock(&prefetch->mutex);
+            
+            size_t need = (prefetch->mask + 1) - fill;
+            if(need > YAUID_PREFETCH_BATCH)
+                need = YAUID_PREFETCH_BATCH;
+            
+            size_t i, got = yauid_get_keys_once(prefetch->producer, keys, need);
+            
+            if(got == 0)
+                usleep(prefetch->producer->sleep_usec);
+            
+            for(i = 0; i < got; i++) {
+                if(yauid_prefetch_push(prefetch, keys[i]) == 0)
+                    break;
+            }
+            
+            pthread_mutex_lock(&prefetch->mutex);
+            continue;
+        }
+        
+        /* consumers check sleeping after pop; recheck count after it is set */
+        __atomic_store_n(&prefetch->sleeping, 1, __ATOMIC_SEQ_CST);
+        
+        if(yauid_prefetch_count(prefetch) >= prefetch->low_watermark && prefetch->stop == 0)
+            pthread_cond_wait(&prefetch->cond, &prefetch->mutex);
+        
+        __atomic_store_n(&prefetch->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+    
+    pthread_mutex_unlock(&prefetch->mutex);
+    
+    return NULL;
+}
+
+hkey_t yauid_prefetch_pop(struct yauid_prefetch *prefetch)
+{
+    hkey_t key;
+    
+    for(;;)
+    {
+        if((key = yauid_prefetch_take(prefetch)) == (hkey_t)(0)) {
+            __atomic_fetch_add(&prefetch->misses, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        
+        if(prefetch->max_age && (unsigned long)time(NULL) > yauid_get_timestamp(key) + prefetch->max_age) {
+            __atomic_fetch_add(&prefetch->stale, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        
+        __atomic_fetch_add(&prefetch->hits, 1, __ATOMIC_RELAXED);
+        break;
+    }
+    
+    if(__atomic_load_n(&prefetch->sleeping, __ATOMIC_SEQ_CST) &&
+       yauid_prefetch_count(prefetch) < prefetch->low_watermark)
+    {
+        pthread_mutex_lock(&prefetch->mutex);
+        pthread_cond_signal(&prefetch->cond);
+        pthread_mutex_unlock(&prefetch->mutex);
+    }
+    
+    return key;
+}
+
+void yauid_prefetch_lock(struct yauid_prefetch *prefetch)
+{
+    pthread_mutex_lock(&prefetch->miss_mutex);
+}
+
+void yauid_prefetch_unlock(struct yauid_prefetch *prefetch)
+{
+    pthread_mutex_unlock(&prefetch->miss_mutex);
+}
+
+yauid_status_t yauid_prefetch_start(yauid* yaobj, size_t size, size_t low_watermark, unsigned int max_age)
+{
+    if(yaobj->prefetch)
+        yauid_prefetch_stop(yaobj);
+    
+    struct yauid_prefetch *prefetch;
+    
+    if(posix_memalign((void **)&prefetch, YAUID_CACHE_LINE, sizeof(struct yauid_prefetch)) != 0)
+        return YAUID_ERROR_CREATE_OBJECT;
+    
+    memset(prefetch, 0, sizeof(struct yauid_prefetch));
+    
+    size_t i, ring_size = 2;
+    while(ring_size < size)
+        ring_size <<= 1;
+    
+    prefetch->mask          = ring_size - 1;
+    prefetch->low_watermark = (low_watermark < ring_size) ? low_watermark : ring_size;
+    prefetch->max_age       = max_age;
+    
+    prefetch->cells = (yauid_prefetch_cell *)malloc(sizeof(yauid_prefetch_cell) * ring_size);
+    if(prefetch->cells == NULL) {
+        free(prefetch);
+        return YAUID_ERROR_CREATE_OBJECT;
+    }
+    
+    for(i = 0; i < ring_size; i++)
+        prefetch->cells[i].seq = i;
+    
+    /* own open file description: flock does not exclude one from itself */
+    prefetch->producer = yauid_init_backend(yaobj->backend, yaobj->c_lockfile, NULL);
+    
+    yauid_status_t status = (prefetch->producer) ? prefetch->producer->error : YAUID_ERROR_CREATE_OBJECT;
+    
+    if(status == YAUID_OK)
+    {
+        yauid_set_node_id(prefetch->producer, yaobj->node_id);
+        yauid_set_sleep_usec(prefetch->producer, yaobj->sleep_usec);
+        
+        status = prefetch->producer->error;
+        
+        if(status == YAUID_OK && yaobj->durable)
+            status = yauid_set_durable(prefetch->producer, 1, yauid_durable_interval(yaobj->durable));
+    }
+    
+    if(status != YAUID_OK) {
+        yauid_destroy(prefetch->producer);
+        free(prefetch->cells);
+        free(prefetch);
+        
+        return status;
+    }
+    
+    pthread_mutex_init(&prefetch->mutex, NULL);
+    pthread_mutex_init(&prefetch->miss_mutex, NULL);
+    pthread_cond_init(&prefetch->cond, NULL);
+    
+    if(pthread_create(&prefetch->thread, NULL, yauid_prefetch_thread, prefetch) != 0) {
+        pthread_cond_destroy(&prefetch->cond);
+        pthread_mutex_destroy(&prefetch->miss_mutex);
+        pthread_mutex_destroy(&prefetch->mutex);
+        yauid_destroy(prefetch->producer);
+        free(prefetch->cells);
+        free(prefetch);
+        
+        return YAUID_ERROR_PREFETCH_THREAD;
+    }
+    
+    yaobj->prefetch = prefetch;
+    
+    return YAUID_OK;
+}
+
+void yauid_prefetch_stop(yauid* yaobj)
+{
+    struct yauid_prefetch *prefetch = yaobj->prefetch;
+    
+    if(prefetch == NULL)
+        return;
+    
+    yaobj->prefetch = NULL;
+    
+    pthread_mutex_lock(&prefetch->mutex);
+    prefetch->stop = 1;
+    pthread_cond_signal(&prefetch->cond);
+    pthread_mutex_unlock(&prefetch->mutex);
+    
+    pthread_join(prefetch->thread, NULL);
+    
+    pthread_cond_destroy(&prefetch->cond);
+    pthread_mutex_destroy(&prefetch->miss_mutex);
+    pthread_mutex_destroy(&prefetch->mutex);
+    
+    yauid_destroy(prefetch->producer);
+    free(prefetch->cells);
+    free(prefetch);
+}
+
+void yauid_get_prefetch_stat(yauid* yaobj, yauid_prefetch_stat *stat)
+{
+    memset(stat, 0, sizeof(yauid_prefetch_stat));
+    
+    if(yaobj->prefetch == NULL)
+        return;
+    
+    stat->hits   = __atomic_load_n(&yaobj->prefetch->hits, __ATOMIC_RELAXED);
+    stat->misses = __atomic_load_n(&yaobj->prefetch->misses, __ATOMIC_RELAXED);
+    stat->stale  = __atomic_load_n(&yaobj->prefetch->stale, __ATOMIC_RELAXED);
+}
+
@@ -0,0 +1,39 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef yauid_yauid_prefetch_h
+#define yauid_yauid_prefetch_h
+
+#include <yauid.h>
+
+/**
+ * Take a key from the ring of prefetch thread
+ *
+ * @param[in] prefetch
+ * @return key or 0 if the ring is empty
+ */
+hkey_t yauid_prefetch_pop(struct yauid_prefetch *prefetch);
+
+/**
+ * Serialize threads that missed the ring and go to the lock file
+ *
+ * @param[in] prefetch
+ */
+void yauid_prefetch_lock(struct yauid_prefetch *prefetch);
+void yauid_prefetch_unlock(struct yauid_prefetch *prefetch);
+
+#endif
+
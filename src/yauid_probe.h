@@ -0,0 +1,71 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef yauid_yauid_probe_h
+#define yauid_yauid_probe_h
+
+/*
+ * USDT probes of provider "yauid". Enabled when <sys/sdt.h> is available
+ * (systemtap-sdt-dev, systemtap-sdt-devel); build with -DYAUID_WITHOUT_USDT to drop them.
+ * A disabled probe is a nop; arguments that cost a clock read are computed only while
+ * a tracer is attached (probe semaphore is set). See tools/yauid_lock.bt
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+
+#if !defined(YAUID_WITHOUT_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define YAUID_WITH_USDT 1
+#endif
+#endif
+
+#ifdef YAUID_WITH_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define YAUID_PROBE_DEFINE(name) \
+    unsigned short yauid_##name##_semaphore __attribute__((unused, section(".probes")))
+
+#define YAUID_PROBE_ENABLED(name) __builtin_expect(yauid_##name##_semaphore != 0, 0)
+
+#define YAUID_PROBE1(name, a)          DTRACE_PROBE1(yauid, name, a)
+#define YAUID_PROBE2(name, a, b)       DTRACE_PROBE2(yauid, name, a, b)
+#define YAUID_PROBE3(name, a, b, c)    DTRACE_PROBE3(yauid, name, a, b, c)
+
+#else
+
+#define YAUID_PROBE_DEFINE(name) extern int yauid_probe_unused_##name
+#define YAUID_PROBE_ENABLED(name) 0
+
+#define YAUID_PROBE1(name, a)
+#define YAUID_PROBE2(name, a, b)
+#define YAUID_PROBE3(name, a, b, c)
+
+#endif
+
+static inline uint64_t yauid_probe_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#endif
+
@@ -0,0 +1,139 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <yauid_shard.h>
+
+/* explicit AVX2 path of yauid_shard_batch, selected at run time */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define YAUID_SHARD_AVX2
+#include <immintrin.h>
+#endif
+
+static inline uint64_t yauid_shard_mix(hkey_t key)
+{
+    /* timestamp and node/inc parts get own multipliers, then a 64 bit finalizer */
+    uint64_t high = key >> (BIT_LIMIT_NODE + BIT_LIMIT_INC);
+    uint64_t low  = key & ((1ULL << (BIT_LIMIT_NODE + BIT_LIMIT_INC)) - 1);
+    uint64_t hash = (high * 0x9E3779B97F4A7C15ULL) ^ (low * 0xC2B2AE3D27D4EB4FULL);
+    
+    hash ^= hash >> 31;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 29;
+    
+    return hash;
+}
+
+static inline uint32_t yauid_shard_range(uint64_t hash, uint32_t shards)
+{
+    return (uint32_t)(((hash >> 32) * (uint64_t)shards) >> 32);
+}
+
+static inline uint32_t yauid_shard_jump_hash(uint64_t hash, uint32_t shards)
+{
+    int64_t b = -1, j = 0;
+    
+    while(j < (int64_t)shards) {
+        b = j;
+        hash = hash * 2862933555777941757ULL + 1;
+        j = (int64_t)((double)(b + 1) * ((double)(1LL << 31) / (double)((hash >> 33) + 1)));
+    }
+    
+    return (uint32_t)b;
+}
+
+uint64_t yauid_shard_hash(hkey_t key)
+{
+    return yauid_shard_mix(key);
+}
+
+uint32_t yauid_shard(hkey_t key, uint32_t shards)
+{
+    return yauid_shard_range(yauid_shard_mix(key), shards);
+}
+
+uint32_t yauid_shard_jump(hkey_t key, uint32_t shards)
+{
+    return yauid_shard_jump_hash(yauid_shard_mix(key), shards);
+}
+
+#ifdef YAUID_SHARD_AVX2
+
+/* low 64 bits of a * c for 4 lanes: AVX2 has 32x32->64 multiply only */
+__attribute__((target("avx2")))
+static inline __m256i yauid_shard_mul64_avx2(__m256i a, uint64_t c)
+{
+    __m256i c_lo = _mm256_set1_epi64x((long long)(c & 0xFFFFFFFFULL));
+    __m256i c_hi = _mm256_set1_epi64x((long long)(c >> 32));
+    
+    __m256i lo    = _mm256_mul_epu32(a, c_lo);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), c_lo),
+                                     _mm256_mul_epu32(a, c_hi));
+    
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+/* same as yauid_shard_mix + yauid_shard_range, 4 keys at a time */
+__attribute__((target("avx2")))
+static size_t yauid_shard_batch_avx2(const hkey_t *keys, size_t count, uint32_t shards, uint32_t *out)
+{
+    const __m256i low_mask = _mm256_set1_epi64x((long long)((1ULL << (BIT_LIMIT_NODE + BIT_LIMIT_INC)) - 1));
+    const __m256i range    = _mm256_set1_epi64x((long long)shards);
+    const __m256i pack     = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+    size_t i;
+    
+    for(i = 0; i + 4 <= count; i += 4)
+    {
+        __m256i key  = _mm256_loadu_si256((const __m256i *)&keys[i]);
+        __m256i high = yauid_shard_mul64_avx2(_mm256_srli_epi64(key, BIT_LIMIT_NODE + BIT_LIMIT_INC), 0x9E3779B97F4A7C15ULL);
+        __m256i low  = yauid_shard_mul64_avx2(_mm256_and_si256(key, low_mask), 0xC2B2AE3D27D4EB4FULL);
+        __m256i hash = _mm256_xor_si256(high, low);
+        
+        hash = _mm256_xor_si256(hash, _mm256_srli_epi64(hash, 31));
+        hash = yauid_shard_mul64_avx2(hash, 0xBF58476D1CE4E5B9ULL);
+        hash = _mm256_xor_si256(hash, _mm256_srli_epi64(hash, 29));
+        
+        __m256i shard = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(hash, 32), range), 32);
+        shard = _mm256_permutevar8x32_epi32(shard, pack);
+        
+        _mm_storeu_si128((__m128i *)&out[i], _mm256_castsi256_si128(shard));
+    }
+    
+    return i;
+}
+
+#endif
+
+void yauid_shard_batch(const hkey_t *keys, size_t count, uint32_t shards, uint32_t *out)
+{
+    size_t i = 0;
+    
+#ifdef YAUID_SHARD_AVX2
+    if(__builtin_cpu_supports("avx2"))
+        i = yauid_shard_batch_avx2(keys, count, shards, out);
+#endif
+    
+    for(; i < count; i++)
+        out[i] = yauid_shard_range(yauid_shard_mix(keys[i]), shards);
+}
+
+void yauid_shard_jump_batch(const hkey_t *keys, size_t count, uint32_t shards, uint32_t *out)
+{
+    size_t i;
+    
+    for(i = 0; i < count; i++)
+        out[i] = yauid_shard_jump_hash(yauid_shard_mix(keys[i]), shards);
+}
+
@@ -0,0 +1,265 @@
+/*
+ Copyright (c) 2014-2016 Alexander Borisov
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <yauid_stat.h>
+#include <yauid_batch.h>
+
+#define YAUID_STAT_CHUNK 256
+
+yauid_stat * yauid_stat_create(size_t seconds, size_t nodes_per_second)
+{
+    if(seconds == 0 || nodes_per_second == 0)
+        return NULL;
+    
+    yauid_stat* stat = (yauid_stat *)calloc(1, sizeof(yauid_stat));
+    if(stat == NULL)
+        return NULL;
+    
+    stat->seconds = seconds;
+    stat->nodes   = 1;
+    
+    while(stat->nodes < nodes_per_second)
+        stat->nodes <<= 1;
+    
+    stat->ring      = (yauid_stat_second *)calloc(seconds, sizeof(yauid_stat_second));
+    stat->entries   = (yauid_stat_entry *)calloc(seconds * stat->nodes, sizeof(yauid_stat_entry));
+    stat->node_keys = (uint64_t *)calloc(NUMBER_LIMIT_NODE + 1, sizeof(uint64_t));
+    stat->node_peak = (uint32_t *)calloc(NUMBER_LIMIT_NODE + 1, sizeof(uint32_t));
+    
+    if(stat->ring == NULL || stat->entries == NULL || stat->node_keys == NULL || stat->node_peak == NULL) {
+        yauid_stat_destroy(stat);
+        return NULL;
+    }
+    
+    size_t i;
+    for(i = 0; i < seconds; i++)
+        stat->ring[i].entries = &stat->entries[i * stat->nodes];
+    
+    return stat;
+}
+
+void yauid_stat_destroy(yauid_stat* stat)
+{
+    if(stat == NULL)
+        return;
+    
+    free(stat->ring);
+    free(stat->entries);
+    free(stat->node_keys);
+    free(stat->node_peak);
+    
+    free(stat);
+}
+
+static void yauid_stat_hist_add(yauid_stat* stat, uint32_t max_inc)
+{
+    if(max_inc)
+        stat->hist[63 - __builtin_clzll((unsigned long long)max_inc)]++;
+}
+
+static void yauid_stat_second_done(yauid_stat* stat, yauid_stat_second *second)
+{
+    if(second->timestamp == 0)
+        return;
+    
+    size_t i;
+    for(i = 0; i < stat->nodes && second->used; i++)
+    {
+        if(second->entries[i].count) {
+            yauid_stat_hist_add(stat, second->entries[i].max_inc);
+            second->used--;
+        }
+    }
+    
+    if(second->keys > stat->peak_keys) {
+        stat->peak_keys      = second->keys;
+        stat->peak_timestamp = second->timestamp;
+    }
+    
+    stat->seconds_done++;
+    
+    memset(second->entries, 0, sizeof(yauid_stat_entry) * stat->nodes);
+    second->timestamp = 0;
+    second->keys      = 0;
+    second->used      = 0;
+}
+
+/* returns 0 if the second is older than the ring */
+static int yauid_stat_account(yauid_stat* stat, uint64_t timestamp, uint32_t node_id,
+                              uint32_t max_inc, uint32_t count)
+{
+    yauid_stat_second *second = &stat->ring[timestamp % stat->seconds];
+    
+    if(second->timestamp != timestamp)
+    {
+        if(second->timestamp > timestamp)
+            return 0;
+        
+        yauid_stat_second_done(stat, second);
+        second->timestamp = timestamp;
+    }
+    
+    second->keys += count;
+    
+    size_t mask = stat->nodes - 1;
+    size_t pos  = (node_id * 0x9E3779B1U) & mask;
+    size_t step;
+    
+    for(step = 0; step < stat->nodes; step++)
+    {
+        yauid_stat_entry *entry = &second->entries[(pos + step) & mask];
+        
+        if(entry->count == 0) {
+            entry->node_id = node_id;
+            entry->max_inc = max_inc;
+            entry->count   = count;
+            
+            second->used++;
+            return 1;
+        }
+        
+        if(entry->node_id == node_id) {
+            if(max_inc > entry->max_inc)
+                entry->max_inc = max_inc;
+            
+            entry->count += count;
+            return 1;
+        }
+    }
+    
+    stat->overflow += count;
+    
+    return 1;
+}
+
+void yauid_stat_feed(yauid_stat* stat, const hkey_t *keys, size_t count)
+{
+    unsigned long timestamps[YAUID_STAT_CHUNK];
+    unsigned long node_ids[YAUID_STAT_CHUNK];
+    unsigned long incs[YAUID_STAT_CHUNK];
+    
+    while(count)
+    {
+        size_t i, len = (count < YAUID_STAT_CHUNK) ? count : YAUID_STAT_CHUNK;
+        
+        yauid_decode_keys(keys, len, timestamps, node_ids, incs);
+        
+        for(i = 0; i < len; i++)
+        {
+            unsigned long node_id = node_ids[i];
+            uint32_t inc = (uint32_t)incs[i];
+            
+            stat->node_keys[node_id]++;
+            
+            if(inc > stat->node_peak[node_id])
+                stat->node_peak[node_id] = inc;
+            
+            if(yauid_stat_account(stat, timestamps[i], (uint32_t)node_id, inc, 1) == 0)
+                stat->late++;
+        }
+        
+        stat->keys += len;
+        
+        keys  += len;
+        count -= len;
+    }
+}
+
+void yauid_stat_merge(yauid_stat* stat, const yauid_stat* from)
+{
+    size_t i, j;
+    
+    for(i = 0; i <= NUMBER_LIMIT_NODE; i++)
+    {
+        stat->node_keys[i] += from->node_keys[i];
+        
+        if(from->node_peak[i] > stat->node_peak[i])
+            stat->node_peak[i] = from->node_peak[i];
+    }
+    
+    for(i = 0; i < YAUID_STAT_HIST_SIZE; i++)
+        stat->hist[i] += from->hist[i];
+    
+    stat->keys         += from->keys;
+    stat->seconds_done += from->seconds_done;
+    stat->late         += from->late;
+    stat->overflow     += from->overflow;
+    
+    if(from->peak_keys > stat->peak_keys) {
+        stat->peak_keys      = from->peak_keys;
+        stat->peak_timestamp = from->peak_timestamp;
+    }
+    
+    for(i = 0; i < from->seconds; i++)
+    {
+        const yauid_stat_second *second = &from->ring[i];
+        
+        if(second->timestamp == 0)
+            continue;
+        
+        for(j = 0; j < from->nodes; j++)
+        {
+            const yauid_stat_entry *entry = &second->entries[j];
+            
+            if(entry->count == 0)
+                continue;
+            
+            /* too old for our ring: count it as a separate second */
+            if(yauid_stat_account(stat, second->timestamp, entry->node_id, entry->max_inc, entry->count) == 0)
+                yauid_stat_hist_add(stat, entry->max_inc);
+        }
+    }
+}
+
+void yauid_stat_flush(yauid_stat* stat)
+{
+    size_t i;
+    
+    for(i = 0; i < stat->seconds; i++)
+        yauid_stat_second_done(stat, &stat->ring[i]);
+}
+
+void yauid_stat_dump(yauid_stat* stat, FILE *fh)
+{
+    size_t i;
+    
+    fprintf(fh, "keys: %"PRIu64"\n", stat->keys);
+    fprintf(fh, "seconds: %"PRIu64"\n", stat->seconds_done);
+    fprintf(fh, "late keys: %"PRIu64"\n", stat->late);
+    fprintf(fh, "overflow keys: %"PRIu64"\n", stat->overflow);
+    fprintf(fh, "peak second: %"PRIu64" (%"PRIu64" keys)\n", stat->peak_timestamp, stat->peak_keys);
+    
+    fprintf(fh, "max inc per node per second (limit %llu):\n", yauid_get_max_inc());
+    
+    for(i = 0; i < YAUID_STAT_HIST_SIZE; i++)
+    {
+        if(stat->hist[i])
+            fprintf(fh, "    %llu-%llu: %"PRIu64"\n", 1ULL << i, (2ULL << i) - 1, stat->hist[i]);
+    }
+    
+    fprintf(fh, "nodes:\n");
+    
+    for(i = 0; i <= NUMBER_LIMIT_NODE; i++)
+    {
+        if(stat->node_keys[i] == 0)
+            continue;
+        
+        fprintf(fh, "    %zu: keys %"PRIu64"; peak inc %"PRIu32" (%.2f%% of limit)\n", i,
+                stat->node_keys[i], stat->node_peak[i],
+                (double)(stat->node_peak[i]) * 100.0 / (double)(NUMBER_LIMIT));
+    }
+}
+